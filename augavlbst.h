@@ -0,0 +1,318 @@
+#ifndef AUGAVLBST_H
+#define AUGAVLBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <limits>
+#include "avlbst.h"
+
+/**
+* Augmentation policies for AugmentedAVLTree. A policy is a monoid over
+* value_type: identity() is the neutral element, combine() has to be
+* associative (it does not have to be commutative, the tree always
+* combines in key order) and lift() turns one key/value pair into an
+* aggregate.
+*/
+template <typename Key, typename Value>
+struct SumAugment
+{
+    typedef Value value_type;
+    value_type identity() const { return Value(); }
+    value_type lift(const Key& key, const Value& value) const { return value; }
+    value_type combine(const value_type& a, const value_type& b) const { return a + b; }
+};
+
+template <typename Key, typename Value>
+struct MinAugment
+{
+    typedef Value value_type;
+    value_type identity() const { return std::numeric_limits<Value>::max(); }
+    value_type lift(const Key& key, const Value& value) const { return value; }
+    value_type combine(const value_type& a, const value_type& b) const { return b < a ? b : a; }
+};
+
+template <typename Key, typename Value>
+struct MaxAugment
+{
+    typedef Value value_type;
+    value_type identity() const { return std::numeric_limits<Value>::lowest(); }
+    value_type lift(const Key& key, const Value& value) const { return value; }
+    value_type combine(const value_type& a, const value_type& b) const { return a < b ? b : a; }
+};
+
+/**
+* An AVLNode that also stores the aggregate of its whole subtree.
+*/
+template <typename Key, typename Value, typename Aggregate>
+class AugmentedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    // Constructor/destructor.
+    AugmentedAVLNode(const Key& key, const Value& value, AugmentedAVLNode* parent, const Aggregate& aggregate);
+    virtual ~AugmentedAVLNode();
+
+    // Getter/setter for the subtree aggregate.
+    const Aggregate& getAggregate() const;
+    void setAggregate(const Aggregate& aggregate);
+
+    // Getters for parent, left, and right, redefined the same way AVLNode does.
+    virtual AugmentedAVLNode* getParent() const override;
+    virtual AugmentedAVLNode* getLeft() const override;
+    virtual AugmentedAVLNode* getRight() const override;
+
+protected:
+    Aggregate aggregate_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the AugmentedAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* A new node is a leaf, so its aggregate is just the lifted key/value pair.
+*/
+template<class Key, class Value, class Aggregate>
+AugmentedAVLNode<Key, Value, Aggregate>::AugmentedAVLNode(const Key& key, const Value& value, AugmentedAVLNode *parent, const Aggregate& aggregate) :
+    AVLNode<Key, Value>(key, value, parent), aggregate_(aggregate)
+{
+
+}
+
+/**
+* A destructor which does nothing.
+*/
+template<class Key, class Value, class Aggregate>
+AugmentedAVLNode<Key, Value, Aggregate>::~AugmentedAVLNode()
+{
+
+}
+
+/**
+* A getter for the aggregate of the subtree rooted at this node.
+*/
+template<class Key, class Value, class Aggregate>
+const Aggregate& AugmentedAVLNode<Key, Value, Aggregate>::getAggregate() const
+{
+    return aggregate_;
+}
+
+/**
+* A setter for the aggregate of the subtree rooted at this node.
+*/
+template<class Key, class Value, class Aggregate>
+void AugmentedAVLNode<Key, Value, Aggregate>::setAggregate(const Aggregate& aggregate)
+{
+    aggregate_ = aggregate;
+}
+
+/**
+* An overridden function for getting the parent since a static_cast is necessary to make sure
+* that our node is a AugmentedAVLNode.
+*/
+template<class Key, class Value, class Aggregate>
+AugmentedAVLNode<Key, Value, Aggregate> *AugmentedAVLNode<Key, Value, Aggregate>::getParent() const
+{
+    return static_cast<AugmentedAVLNode*>(this->parent_);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value, class Aggregate>
+AugmentedAVLNode<Key, Value, Aggregate> *AugmentedAVLNode<Key, Value, Aggregate>::getLeft() const
+{
+    return static_cast<AugmentedAVLNode*>(this->children_[0]);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value, class Aggregate>
+AugmentedAVLNode<Key, Value, Aggregate> *AugmentedAVLNode<Key, Value, Aggregate>::getRight() const
+{
+    return static_cast<AugmentedAVLNode*>(this->children_[1]);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the AugmentedAVLNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* An AVLTree where every node keeps Monoid's aggregate of its subtree,
+* so rangeAggregate(lo, hi) is O(log n) instead of an O(k) iterator walk.
+* The aggregates are recomputed after every rotation and along the
+* path of every insert and remove.
+*
+* Note: changing a value through operator[] or an iterator bypasses
+* that bookkeeping. Use insert() to overwrite values instead.
+*/
+template <class Key, class Value, class Monoid = SumAugment<Key, Value> >
+class AugmentedAVLTree : public AVLTree<Key, Value>
+{
+public:
+    typedef typename Monoid::value_type aggregate_type;
+    typedef AugmentedAVLNode<Key, Value, aggregate_type> NodeType;
+
+    AugmentedAVLTree(const Monoid& monoid = Monoid());
+
+    // Aggregate of the whole tree (identity() when empty)
+    aggregate_type aggregate() const;
+    // Aggregate of every key in [lo, hi], combined in key order
+    aggregate_type rangeAggregate(const Key& lo, const Key& hi) const;
+
+protected:
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual Node<Key, Value>* relocateNode(const Node<Key, Value>* node, void* where) const;
+    virtual size_t nodeSize() const;
+    virtual void refreshNode(Node<Key, Value>* node);
+    virtual void refreshPath(Node<Key, Value>* node);
+    aggregate_type subtreeAggregate(NodeType* node) const;
+    aggregate_type liftNode(NodeType* node) const;
+
+    Monoid monoid_;
+};
+
+template<class Key, class Value, class Monoid>
+AugmentedAVLTree<Key, Value, Monoid>::AugmentedAVLTree(const Monoid& monoid) :
+    monoid_(monoid)
+{
+
+}
+
+/**
+* Node factory for BinarySearchTree::insert, so every node in the tree
+* carries an aggregate.
+*/
+template<class Key, class Value, class Monoid>
+Node<Key, Value>* AugmentedAVLTree<Key, Value, Monoid>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+  return new NodeType(key, value, static_cast<NodeType*>(parent), monoid_.lift(key, value));
+}
+
+template<class Key, class Value, class Monoid>
+Node<Key, Value>* AugmentedAVLTree<Key, Value, Monoid>::relocateNode(const Node<Key, Value>* node, void* where) const
+{
+  return new (where) NodeType(*static_cast<const NodeType*>(node));
+}
+
+template<class Key, class Value, class Monoid>
+size_t AugmentedAVLTree<Key, Value, Monoid>::nodeSize() const
+{
+  return sizeof(NodeType);
+}
+
+/**
+* Empty subtrees aggregate to the identity.
+*/
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::aggregate_type
+AugmentedAVLTree<Key, Value, Monoid>::subtreeAggregate(NodeType* node) const
+{
+  if(node == nullptr){
+    return monoid_.identity();
+  }
+  return node->getAggregate();
+}
+
+/**
+* A node's own contribution. Lazily removed nodes count as empty.
+*/
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::aggregate_type
+AugmentedAVLTree<Key, Value, Monoid>::liftNode(NodeType* node) const
+{
+  if(node->isTombstone()){
+    return monoid_.identity();
+  }
+  return monoid_.lift(node->getKey(), node->getValue());
+}
+
+template<class Key, class Value, class Monoid>
+void AugmentedAVLTree<Key, Value, Monoid>::refreshNode(Node<Key, Value>* node)
+{
+  NodeType* current = static_cast<NodeType*>(node);
+  current->setAggregate(monoid_.combine(
+      monoid_.combine(subtreeAggregate(current->getLeft()), liftNode(current)),
+      subtreeAggregate(current->getRight())));
+}
+
+template<class Key, class Value, class Monoid>
+void AugmentedAVLTree<Key, Value, Monoid>::refreshPath(Node<Key, Value>* node)
+{
+  while(node != nullptr){
+    refreshNode(node);
+    node = node->getParent();
+  }
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::aggregate_type
+AugmentedAVLTree<Key, Value, Monoid>::aggregate() const
+{
+  return subtreeAggregate(static_cast<NodeType*>(this->root_));
+}
+
+/**
+* Finds the highest node inside [lo, hi], then walks down both of its
+* sides. Going down the left side, every node >= lo contributes itself
+* plus its whole right subtree; the right side is the mirror image. That
+* touches at most two root-to-leaf paths.
+*/
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::aggregate_type
+AugmentedAVLTree<Key, Value, Monoid>::rangeAggregate(const Key& lo, const Key& hi) const
+{
+  NodeType* split = static_cast<NodeType*>(this->root_);
+  while(split != nullptr){
+    if(split->getKey() < lo){
+      split = split->getRight();
+    }
+    else if(hi < split->getKey()){
+      split = split->getLeft();
+    }
+    else{
+      break;
+    }
+  }
+
+  // Nothing in the range (this also covers lo > hi)
+  if(split == nullptr){
+    return monoid_.identity();
+  }
+
+  // Everything collected on the left side is smaller than what is already
+  // in left, so it gets combined in front
+  aggregate_type left = monoid_.identity();
+  NodeType* current = split->getLeft();
+  while(current != nullptr){
+    if(current->getKey() < lo){
+      current = current->getRight();
+    }
+    else{
+      left = monoid_.combine(monoid_.combine(liftNode(current), subtreeAggregate(current->getRight())), left);
+      current = current->getLeft();
+    }
+  }
+
+  aggregate_type right = monoid_.identity();
+  current = split->getRight();
+  while(current != nullptr){
+    if(hi < current->getKey()){
+      current = current->getLeft();
+    }
+    else{
+      right = monoid_.combine(right, monoid_.combine(subtreeAggregate(current->getLeft()), liftNode(current)));
+      current = current->getRight();
+    }
+  }
+
+  return monoid_.combine(monoid_.combine(left, liftNode(split)), right);
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <cmath>
 #include "bst.h"
 
 struct KeyError { };
@@ -107,7 +108,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return static_cast<AVLNode<Key, Value>*>(this->children_[0]);
 }
 
 /**
@@ -116,7 +117,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return static_cast<AVLNode<Key, Value>*>(this->children_[1]);
 }
 
 
@@ -131,23 +132,62 @@ template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
+    // insert() and remove() come from BinarySearchTree; the AVL work is
+    // in rebalanceInsert() and removeNode()
+    AVLTree();
+
+    // Batch mode: between beginBatch() and endBatch() inserts and removes
+    // skip the AVL fix-ups and only mark the nodes above them as stale.
+    // Lookups stay correct, but the tree can get as deep as a plain BST.
+    // endBatch() restores the AVL invariant. Batches don't nest.
+    void beginBatch();
+    void endBatch();
+    bool inBatch() const;
+
+    // Removes every item with lo <= key <= hi: the range is cut out along
+    // two paths, the tree is rebalanced once (as by endBatch()) and the
+    // cut-out nodes are freed in one pass. In a batch the rebalancing
+    // waits for endBatch(). Returns how many items went. O(log^2 n + k),
+    // not the O(log n + k) of a split/join: the nodes only store their
+    // balance, so the rebalancing measures each of the O(log n) subtrees
+    // hanging off the two paths with an O(log n) walk.
+    virtual size_t removeRange(const Key& lo, const Key& hi);
+
 protected:
+    // Balance of a node whose subtree changed during a batch
+    static const int8_t STALE_BALANCE = 3;
+
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual void relinkNode(Node<Key, Value>* node, size_t leftSize, size_t rightSize, int depth);
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual Node<Key, Value>* relocateNode(const Node<Key, Value>* node, void* where) const;
+    virtual void rebalanceInsert(Node<Key, Value>* newNode);
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
     void rotateLeft(AVLNode<Key, Value>* current);
     void rotateRight(AVLNode<Key, Value>* current);
     void insertFix(AVLNode<Key, Value>* child, AVLNode<Key, Value>* parent);
     void removeFix(AVLNode<Key, Value>* child, int diff);
     int findBalance(AVLNode<Key, Value>* node) const;
+    void markStale(AVLNode<Key, Value>* node);
+    void joinChildren(AVLNode<Key, Value>* node, int leftHeight, int rightHeight);
+    int cleanHeight(AVLNode<Key, Value>* node) const;
+    virtual void describeNode(const Node<Key, Value>* node, ExportFields& fields) const;
+    virtual size_t nodeSize() const;
 
+    bool batching_;
 };
 
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree() :
+    batching_(false)
+{
+
+}
+
 // HELPER FUNCTIONS FOR INSERT
 template<class Key, class Value>
 void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* current)
 {
-  
   AVLNode<Key, Value>* rightChild = current->getRight();
 
   // Case where there is not rightChild
@@ -155,37 +195,15 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* current)
     return; // No rotation needed
   }
 
-  current->setRight(rightChild->getLeft());
-  if(rightChild->getLeft() != nullptr){
-    rightChild->getLeft()->setParent(current);
-  }
-
-  // Making rightChild the new root
-  rightChild->setLeft(current);
-  rightChild->setParent(current->getParent());
-
-  // Updating current's parent to rightChild
-  if(current->getParent() != nullptr){
-    if(current->getParent()->getLeft() == current){
-      current->getParent()->setLeft(rightChild);
-    }
-    else{
-      current->getParent()->setRight(rightChild);
-    }
-  }
-  else{
-    // Case if current was the root
-    this->root_ = rightChild;
-  }
-
-  current->setParent(rightChild);
+  // The pointer work is shared with the other trees
+  BinarySearchTree<Key, Value>::rotateLeft(current);
 
   // Adjusting balances
   int8_t currBalance = current->getBalance();
   int8_t rightBalance = rightChild->getBalance();
 
   current->setBalance(currBalance - std::max(rightBalance, static_cast<int8_t>(0)) - 1);
-  rightChild->setBalance(rightBalance - std::min(current->getBalance(), static_cast<int8_t>(0)) + 1);
+  rightChild->setBalance(rightBalance + std::min(current->getBalance(), static_cast<int8_t>(0)) - 1);
   
 }
 
@@ -200,37 +218,15 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* current)
     return; // No rotation needed
   }
 
-  current->setLeft(leftChild->getRight());
-  if(leftChild->getRight() != nullptr){
-    leftChild->getRight()->setParent(current);
-  }
-
-  // Making leftChild the new root
-  leftChild->setRight(current);
-  leftChild->setParent(current->getParent());
-
-  // Updating current's parent to leftChild
-  if(current->getParent() != nullptr){
-    if(current->getParent()->getLeft() == current){
-      current->getParent()->setLeft(leftChild);
-    }
-    else{
-      current->getParent()->setRight(leftChild);
-    }
-  }
-  else{
-    // Case if current was the root
-    this->root_ = leftChild;
-  }
-
-  current->setParent(leftChild);
+  // The pointer work is shared with the other trees
+  BinarySearchTree<Key, Value>::rotateRight(current);
 
   // Adjusting balances
   int8_t currBalance = current->getBalance();
   int8_t leftBalance = leftChild->getBalance();
 
   current->setBalance(currBalance - std::min(leftBalance, static_cast<int8_t>(0)) + 1);
-  leftChild->setBalance(leftBalance - std::max(current->getBalance(), static_cast<int8_t>(0)) - 1);
+  leftChild->setBalance(leftBalance + std::max(current->getBalance(), static_cast<int8_t>(0)) + 1);
 
 }
 
@@ -254,20 +250,21 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* child, AVLNode<Key, Val
       // LR case 
       else if(child->getBalance() == 1){
         AVLNode<Key, Value>* rightChild = child->getRight();
+        int8_t grandchildBalance = rightChild->getBalance();
         rotateLeft(child);
         rotateRight(parent);
 
-        // Update balances
-        if(rightChild->getBalance() == 1){
+        // Update balances (the rotations already touched rightChild's)
+        if(grandchildBalance == 1){
           parent->setBalance(0);
           child->setBalance(-1);
         }
-        else if(rightChild->getBalance() == 0){
+        else if(grandchildBalance == 0){
           parent->setBalance(0);
           child->setBalance(0);
         }
         else{
-          parent->setBalance(-1);
+          parent->setBalance(1);
           child->setBalance(0);
         }
 
@@ -289,15 +286,16 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* child, AVLNode<Key, Val
       // RL case
       else if(child->getBalance() == -1){
         AVLNode<Key, Value>* leftChild = child->getLeft();
+        int8_t grandchildBalance = leftChild->getBalance();
         rotateRight(child);
         rotateLeft(parent);
 
-        // Update balances
-        if(leftChild->getBalance() == -1){
+        // Update balances (the rotations already touched leftChild's)
+        if(grandchildBalance == -1){
           parent->setBalance(0);
-          child->setBalance(-1);
+          child->setBalance(1);
         }
-        else if(leftChild->getBalance() == 0){
+        else if(grandchildBalance == 0){
           parent->setBalance(0);
           child->setBalance(0);
         }
@@ -317,56 +315,36 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* child, AVLNode<Key, Val
 }
 
 
+/**
+* Node factory for BinarySearchTree::insert, so every node in the tree
+* is an AVLNode.
+*/
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+  return new AVLNode<Key, Value>(key, value, static_cast<AVLNode<Key, Value>*>(parent));
+}
+
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::relocateNode(const Node<Key, Value>* node, void* where) const
+{
+  return new (where) AVLNode<Key, Value>(*static_cast<const AVLNode<Key, Value>*>(node));
+}
+
 /*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
+ * Called by BinarySearchTree::insert once the new leaf is linked in.
+ * Walks up updating balances until a subtree's height stops changing
+ * or a rotation fixes it.
  */
 template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+void AVLTree<Key, Value>::rebalanceInsert(Node<Key, Value>* newNode)
 {
-  // Using the insert() function from BST
-  // Base case: empty tree
-  if(this->root_ == nullptr){
-    // Create new node and set it as the root
-    this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
+  AVLNode<Key, Value>* child = static_cast<AVLNode<Key, Value>*>(newNode);
+  if(batching_){
+    markStale(child->getParent());
     return;
   }
-
-  // Now we need to traverse the tree, checking how new_item's key compares to each node's key
-  AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
-  AVLNode<Key, Value>* parent = nullptr;
-
-  while(current != nullptr){
-    parent = current;
-    // Case where the inserted node is less than current node -> move left
-    if(new_item.first < current->getItem().first){
-      current = current->getLeft();
-    }
-    // Case where the inserted node is greater than current node -> move right
-    else if(new_item.first > current->getItem().first){
-      current = current->getRight();
-    }
-    // Case where the inserted node is the same as current node -> overwrite value
-    else{
-      current->setValue(new_item.second);
-      return;
-    }
-  }
-
-  // Now we have reached the spot where we can insert the new node
-  AVLNode<Key, Value>* newNode = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
-  if(new_item.first < parent->getItem().first){
-    parent->setLeft(newNode);
-
-  }
-  else{
-    parent->setRight(newNode);
-    // parent->setBalance(parent->getBalance() + 1); // Updating balance
-
-  }
-
-  AVLNode<Key, Value>* child = newNode;
-  AVLNode<Key, Value>* node = parent;
+  AVLNode<Key, Value>* node = child->getParent();
 
   while(node != nullptr){
     if(child == node->getLeft()){
@@ -395,107 +373,168 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
 template<typename Key, typename Value>
 int AVLTree<Key, Value>::findBalance(AVLNode<Key, Value>* node) const{
 
-  return findHeight(node->getRight()) - findHeight(node->getLeft());
+  return this->findHeight(node->getRight()) - this->findHeight(node->getLeft());
 
 }
 
+/**
+* Rebalances after a removal. diff is the change in current's balance
+* (+1 if its left subtree got shorter, -1 if its right one did).
+* Written as a loop that climbs toward the root rather than recursing.
+*/
 template<class Key, class Value>
 void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* current, int diff)
 {
-  if(current == nullptr){
-    return;
-  }
-
-  AVLNode<Key, Value>* parent = current->getParent();
-  int ndiff = 0;
+  while(current != nullptr){
+    AVLNode<Key, Value>* parent = current->getParent();
+    int ndiff = 0;
 
-  if(parent != nullptr){
-    if(current == parent->getLeft()){
-      ndiff = -1;
-    }
-    else{
-      ndiff = 1;
+    if(parent != nullptr){
+      if(current == parent->getLeft()){
+        ndiff = 1;
+      }
+      else{
+        ndiff = -1;
+      }
     }
-  }
 
-  int spread = current->getBalance() + diff;
+    int spread = current->getBalance() + diff;
 
-  // WHERE DIFF == -1
-  if(diff == -1){
-    AVLNode<Key, Value>* child = static_cast<AVLNode<Key, Value>*>(current->getLeft());
-    int childBalance = 0;
+    // WHERE DIFF == -1
+    if(diff == -1){
+      // Case 1: balance + diff = -2
+      if(spread == -2){
+        AVLNode<Key, Value>* child = current->getLeft();
+        int childBalance = child->getBalance();
 
-    if(child != nullptr){
-      childBalance = child->getBalance();
-    }
-    // Case 1: balance + diff = -2
-    if(spread == -2){
-      // Case 1a: balance of child = -1
-      if(childBalance == -1){
-        rotateRight(current);
-        removeFix(parent, ndiff);
+        // Case 1a: balance of child = -1
+        if(childBalance == -1){
+          rotateRight(current);
+          current->setBalance(0);
+          child->setBalance(0);
+        }
+        // Case 1b: balance of child = 0 -> height didn't change, done
+        else if(childBalance == 0){
+          rotateRight(current);
+          current->setBalance(-1);
+          child->setBalance(1);
+          return;
+        }
+        // Case 1c: balance of child = 1
+        else{
+          AVLNode<Key, Value>* grandchild = child->getRight();
+          int8_t grandchildBalance = grandchild->getBalance();
+          rotateLeft(child);
+          rotateRight(current);
+
+          if(grandchildBalance == 1){
+            current->setBalance(0);
+            child->setBalance(-1);
+          }
+          else if(grandchildBalance == 0){
+            current->setBalance(0);
+            child->setBalance(0);
+          }
+          else{
+            current->setBalance(1);
+            child->setBalance(0);
+          }
+          grandchild->setBalance(0);
+        }
       }
-      // Case 1b: balance of child = 0
-      if(childBalance == 0){
-        rotateRight(current);
 
+      // Case 2: balance + diff = -1 -> height didn't change, done
+      else if(spread == -1){
+        current->setBalance(-1);
+        return;
       }
-      // Case 1c: balance of child = 1
-      if(childBalance == 1){
-        // AVLNode<Key, Value>* grandchild = child->getRight();
-        rotateLeft(child);
-        rotateRight(child);
-
-        removeFix(parent, ndiff);
+      // Case 3: balance + diff = 0 -> subtree got shorter, keep going
+      else{
+        current->setBalance(0);
       }
 
     }
 
-    // Case 2: balance + diff = -1
-    // Case 3: balance + diff = 0
-    else if(spread == 0){
-      removeFix(parent, ndiff);
-    }
-
-  }
-
-  // WHERE DIFF == 1
-  else if(diff == 1){
-    AVLNode<Key, Value>* child = static_cast<AVLNode<Key, Value>*>(current->getRight());
-    int childBalance = 0;
-    
-    if(child != nullptr){
-      childBalance = child->getBalance();
-    }
-    // Case 1: balance + diff = 2
-    if(spread == 2){
-      // Case 1a: balance of child = 1
-      if(childBalance == 1){
-        rotateLeft(current);
-        removeFix(parent, ndiff);
+    // WHERE DIFF == 1
+    else if(diff == 1){
+      // Case 1: balance + diff = 2
+      if(spread == 2){
+        AVLNode<Key, Value>* child = current->getRight();
+        int childBalance = child->getBalance();
+
+        // Case 1a: balance of child = 1
+        if(childBalance == 1){
+          rotateLeft(current);
+          current->setBalance(0);
+          child->setBalance(0);
+        }
+        // Case 1b: balance of child = 0 -> height didn't change, done
+        else if(childBalance == 0){
+          rotateLeft(current);
+          current->setBalance(1);
+          child->setBalance(-1);
+          return;
+        }
+        // Case 1c: balance of child = -1
+        else{
+          AVLNode<Key, Value>* grandchild = child->getLeft();
+          int8_t grandchildBalance = grandchild->getBalance();
+          rotateRight(child);
+          rotateLeft(current);
+
+          if(grandchildBalance == -1){
+            current->setBalance(0);
+            child->setBalance(1);
+          }
+          else if(grandchildBalance == 0){
+            current->setBalance(0);
+            child->setBalance(0);
+          }
+          else{
+            current->setBalance(-1);
+            child->setBalance(0);
+          }
+          grandchild->setBalance(0);
+        }
       }
-      // Case 1b: balance of child = 0
-      if(childBalance == 0){
-        rotateLeft(current);
 
+      // Case 2: balance + diff = 1 -> height didn't change, done
+      else if(spread == 1){
+        current->setBalance(1);
+        return;
       }
-      // Case 1c: balance of child = -1
-      if(childBalance == -1){
-        // AVLNode<Key, Value>* grandchild = child->getRight();
-        rotateRight(child);
-        rotateLeft(child);
-
-        removeFix(parent, ndiff);
+      // Case 3: balance + diff = 0 -> subtree got shorter, keep going
+      else{
+        current->setBalance(0);
       }
-
     }
-
-    // Case 2: balance + diff = -1
-    // Case 3: balance + diff = 0
-    else if(spread == 0){
-      removeFix(parent, ndiff);
+    else{
+      return;
     }
+
+    // This subtree got shorter -> continue with the parent
+    current = parent;
+    diff = ndiff;
+  }
+}
+
+/**
+* compact() and buildParallel() build every subtree by splitting its
+* range in the middle, so a subtree of n nodes is exactly bit-length(n)
+* high.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::relinkNode(Node<Key, Value>* node, size_t leftSize, size_t rightSize, int depth)
+{
+  int leftHeight = 0;
+  for(size_t n = leftSize; n > 0; n /= 2){
+    ++leftHeight;
+  }
+  int rightHeight = 0;
+  for(size_t n = rightSize; n > 0; n /= 2){
+    ++rightHeight;
   }
+  static_cast<AVLNode<Key, Value>*>(node)->setBalance(rightHeight - leftHeight);
 }
 
 /*
@@ -503,28 +542,30 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* current, int diff)
  * should swap with the predecessor and then remove.
  */
 template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+void AVLTree<Key, Value>::removeNode(Node<Key, Value>* node)
 {
   // Using my remove() function from BST
-  AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
+  AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(node);
   int diff = 0;
 
-  while(current != nullptr && current->getKey() != key){
-    // parent = current; // Moving down the tree
-    if(key < current->getKey()){
-      current = current->getLeft();
-    }
-    else{
-      current = current->getRight();
+  // In a batch: plain BST removal, then mark everything above the spot
+  // that actually lost a node. When current has two children that is the
+  // predecessor's old place, and the predecessor itself moved up, so it
+  // has to be marked from its new place as well.
+  if(batching_){
+    AVLNode<Key, Value>* changed = current->getParent();
+    AVLNode<Key, Value>* pred = nullptr;
+    if(current->getLeft() != nullptr && current->getRight() != nullptr){
+      pred = static_cast<AVLNode<Key, Value>*>(this->predecessor(current));
+      changed = pred->getParent() == current ? pred : pred->getParent();
     }
-  }
-
-  // Case where the key wasn't found
-  if(current == nullptr){
+    BinarySearchTree<Key, Value>::removeNode(current);
+    markStale(pred);
+    markStale(changed);
+    this->refreshPath(changed);
     return;
   }
 
-  // Now that we've found the node to remove, we need to actually remove it
   AVLNode<Key, Value>* parent = current->getParent();
 
   // Case 1: Has no children
@@ -543,8 +584,9 @@ void AVLTree<Key, Value>:: remove(const Key& key)
       diff = -1;
     }
 
-    delete current;
+    this->destroyNode(current);
     removeFix(parent, diff);
+    this->refreshPath(parent);
   }
 
   // Case 2: Only one child
@@ -574,9 +616,10 @@ void AVLTree<Key, Value>:: remove(const Key& key)
       diff = -1;
     }
 
-    delete current;
+    this->destroyNode(current);
     current = nullptr;
     removeFix(parent, diff);
+    this->refreshPath(parent);
   }
 
   // Case 3: Both children
@@ -618,12 +661,395 @@ void AVLTree<Key, Value>:: remove(const Key& key)
       this->root_ = child;
     }
 
-    delete nodeToDelete;
+    this->destroyNode(nodeToDelete);
 
     removeFix(parent, diff);
+    this->refreshPath(parent);
   } 
 }
 
+template<class Key, class Value>
+void AVLTree<Key, Value>::beginBatch()
+{
+  batching_ = true;
+}
+
+template<class Key, class Value>
+bool AVLTree<Key, Value>::inBatch() const
+{
+  return batching_;
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::nodeSize() const
+{
+  return sizeof(AVLNode<Key, Value>);
+}
+
+/**
+* Exporters show each node's balance, or "stale" inside a batch.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::describeNode(const Node<Key, Value>* node, ExportFields& fields) const
+{
+  BinarySearchTree<Key, Value>::describeNode(node, fields);
+  int8_t balance = static_cast<const AVLNode<Key, Value>*>(node)->getBalance();
+  std::string text = (balance == STALE_BALANCE) ? std::string("stale") : std::to_string((int)balance);
+  fields.push_back(ExportField("balance", text, balance != STALE_BALANCE));
+}
+
+/**
+* Stale nodes always form a connected set that hangs from the root, so
+* every subtree without a stale top is still a valid AVL tree. When the
+* stale nodes alone are deeper than any AVL tree of this size could be
+* and make up a good part of the tree, the whole tree is rebuilt in
+* O(n). Otherwise they are fixed bottom-up: a node whose children differ
+* in height by one at most just gets its balance back, any other node
+* joins its two subtrees back together.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::endBatch()
+{
+  if(!batching_){
+    return;
+  }
+  batching_ = false;
+
+  AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+  if(root == nullptr || root->getBalance() != STALE_BALANCE){
+    return;
+  }
+
+  // Stale nodes in pre-order, so walking the list backwards sees
+  // children before their parents. Each one remembers where its parent
+  // is in the list, to hand its height up.
+  struct StaleNode {
+    AVLNode<Key, Value>* node;
+    size_t parent;
+    bool isLeft;
+    int leftHeight, rightHeight;
+  };
+  std::vector<StaleNode> stale;
+  std::vector<std::pair<StaleNode, int> > stack;
+  StaleNode top = { root, 0, false, -1, -1 };
+  stack.push_back(std::make_pair(top, 1));
+  int staleHeight = 0;
+  while(!stack.empty()){
+    StaleNode entry = stack.back().first;
+    int depth = stack.back().second;
+    stack.pop_back();
+    size_t index = stale.size();
+    stale.push_back(entry);
+    staleHeight = std::max(staleHeight, depth);
+
+    AVLNode<Key, Value>* right = entry.node->getRight();
+    if(right != nullptr && right->getBalance() == STALE_BALANCE){
+      StaleNode child = { right, index, false, -1, -1 };
+      stack.push_back(std::make_pair(child, depth + 1));
+    }
+    AVLNode<Key, Value>* left = entry.node->getLeft();
+    if(left != nullptr && left->getBalance() == STALE_BALANCE){
+      StaleNode child = { left, index, true, -1, -1 };
+      stack.push_back(std::make_pair(child, depth + 1));
+    }
+  }
+
+  // An AVL tree with n nodes is less than 1.4405 log2(n + 2) high. Past
+  // that, rebuild everything, unless the batch only touched a small part
+  // of the tree (a run of appends, say) and fixing that part is cheaper.
+  if(staleHeight > 1.4405 * std::log2(this->nodeCount_ + 2.0) && stale.size() * 4 > this->nodeCount_){
+    this->rebuildSubtree(root);
+    return;
+  }
+
+  for(size_t i = stale.size(); i > 0; --i){
+    StaleNode& entry = stale[i - 1];
+    AVLNode<Key, Value>* node = entry.node;
+    AVLNode<Key, Value>* left = node->getLeft();
+    AVLNode<Key, Value>* right = node->getRight();
+    int leftHeight = entry.leftHeight >= 0 ? entry.leftHeight : cleanHeight(left);
+    int rightHeight = entry.rightHeight >= 0 ? entry.rightHeight : cleanHeight(right);
+    int diff = rightHeight - leftHeight;
+
+    if(std::abs(diff) <= 1){
+      node->setBalance(diff);
+      if(i > 1){
+        int height = std::max(leftHeight, rightHeight) + 1;
+        (entry.isLeft ? stale[entry.parent].leftHeight : stale[entry.parent].rightHeight) = height;
+      }
+    }
+    // The subtree gets a new top, so its parent measures it with
+    // cleanHeight() instead
+    else{
+      joinChildren(node, leftHeight, rightHeight);
+    }
+  }
+}
+
+/**
+* The topmost node in [lo, hi] splits the range: its left subtree loses
+* everything from lo up and its right subtree everything up to hi, each
+* along one path, and the nodes hanging off those paths inside the range
+* go as whole subtrees. The smallest key left on the right (the last
+* node kept on that path) takes the top node's place. Everything that
+* changed height is then marked stale for endBatch(), which costs
+* O(log^2 n) on top of the O(k) for freeing.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::removeRange(const Key& lo, const Key& hi)
+{
+  if(hi < lo){
+    return 0;
+  }
+  AVLNode<Key, Value>* top = static_cast<AVLNode<Key, Value>*>(this->root_);
+  while(top != nullptr && (top->getKey() < lo || hi < top->getKey())){
+    top = (top->getKey() < lo) ? top->getRight() : top->getLeft();
+  }
+  if(top == nullptr){
+    return 0;
+  }
+
+  // (node, whole subtree?) to free once the tree is back together
+  std::vector<std::pair<Node<Key, Value>*, bool> > doomed(1, std::make_pair(top, false));
+
+  // Left side, keeping the keys below lo: a kept node keeps its left
+  // subtree and the walk goes on to its right, a cut one loses its right
+  // subtree and the walk goes on to its left. The kept nodes are chained
+  // through their right children.
+  AVLNode<Key, Value>* left = nullptr;
+  AVLNode<Key, Value>* lastLeft = nullptr;
+  for(AVLNode<Key, Value>* node = top->getLeft(); node != nullptr; ){
+    if(node->getKey() < lo){
+      node->setParent(lastLeft);
+      if(lastLeft == nullptr){
+        left = node;
+      }
+      else{
+        lastLeft->setRight(node);
+      }
+      lastLeft = node;
+      node = node->getRight();
+    }
+    else{
+      if(node->getRight() != nullptr){
+        doomed.push_back(std::make_pair(node->getRight(), true));
+      }
+      doomed.push_back(std::make_pair(node, false));
+      node = node->getLeft();
+    }
+  }
+  if(lastLeft != nullptr){
+    lastLeft->setRight(nullptr);
+  }
+
+  // The mirror image on the right, keeping the keys above hi
+  AVLNode<Key, Value>* right = nullptr;
+  AVLNode<Key, Value>* lastRight = nullptr;
+  for(AVLNode<Key, Value>* node = top->getRight(); node != nullptr; ){
+    if(hi < node->getKey()){
+      node->setParent(lastRight);
+      if(lastRight == nullptr){
+        right = node;
+      }
+      else{
+        lastRight->setLeft(node);
+      }
+      lastRight = node;
+      node = node->getLeft();
+    }
+    else{
+      if(node->getLeft() != nullptr){
+        doomed.push_back(std::make_pair(node->getLeft(), true));
+      }
+      doomed.push_back(std::make_pair(node, false));
+      node = node->getRight();
+    }
+  }
+  if(lastRight != nullptr){
+    lastRight->setLeft(nullptr);
+  }
+
+  // lastRight has no left child, so it can leave its spot to its right
+  // subtree and take the top's place over both sides
+  AVLNode<Key, Value>* replacement = (left != nullptr) ? left : right;
+  AVLNode<Key, Value>* below = nullptr;
+  if(left != nullptr && right != nullptr){
+    replacement = lastRight;
+    below = lastRight->getParent();
+    if(below != nullptr){
+      below->setLeft(lastRight->getRight());
+      if(lastRight->getRight() != nullptr){
+        lastRight->getRight()->setParent(below);
+      }
+      lastRight->setRight(right);
+      right->setParent(lastRight);
+    }
+    lastRight->setLeft(left);
+    left->setParent(lastRight);
+    this->refreshKeyPrefix(lastRight);
+  }
+  AVLNode<Key, Value>* parent = top->getParent();
+  if(replacement != nullptr){
+    replacement->setParent(parent);
+  }
+  if(parent == nullptr){
+    this->root_ = replacement;
+  }
+  else if(parent->getLeft() == top){
+    parent->setLeft(replacement);
+  }
+  else{
+    parent->setRight(replacement);
+  }
+
+  // Topmost first: markStale() stops at the first stale node, which is
+  // only right if everything above that one is stale too
+  bool batching = batching_;
+  batching_ = true;
+  AVLNode<Key, Value>* changed[] = { replacement != nullptr ? replacement : parent, lastLeft, lastRight, below };
+  for(int i = 0; i < 4; ++i){
+    markStale(changed[i]);
+  }
+  for(int i = 3; i >= 0; --i){
+    this->refreshPath(changed[i]);
+  }
+
+  size_t removed = 0;
+  std::vector<Node<Key, Value>*> stack;
+  for(size_t i = 0; i < doomed.size(); ++i){
+    stack.assign(1, doomed[i].first);
+    while(!stack.empty()){
+      Node<Key, Value>* node = stack.back();
+      stack.pop_back();
+      if(doomed[i].second){
+        for(int side = 0; side < 2; ++side){
+          if(node->getChild(side) != nullptr){
+            stack.push_back(node->getChild(side));
+          }
+        }
+      }
+      if(!node->isTombstone()){
+        ++removed;
+      }
+      this->destroyNode(node);
+    }
+  }
+
+  if(!batching){
+    endBatch();
+  }
+  return removed;
+}
+
+/**
+* node's two subtrees are valid AVL trees whose heights differ by two
+* or more. This is the AVL join: the taller subtree takes node's place,
+* and node (with the shorter subtree) goes back in along the taller
+* one's inner spine, where the heights match. The one path that got
+* taller is then fixed like after an insert, up to where node was.
+* O(height difference).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::joinChildren(AVLNode<Key, Value>* node, int leftHeight, int rightHeight)
+{
+  AVLNode<Key, Value>* parent = node->getParent();
+  bool rightTaller = rightHeight > leftHeight;
+  AVLNode<Key, Value>* top = rightTaller ? node->getRight() : node->getLeft();
+
+  // The taller subtree moves up into node's place
+  top->setParent(parent);
+  if(parent == nullptr){
+    this->root_ = top;
+  }
+  else if(parent->getLeft() == node){
+    parent->setLeft(top);
+  }
+  else{
+    parent->setRight(top);
+  }
+
+  // Walk down its inner spine to the first subtree that is no more than
+  // one taller than the short side; heights follow from the balances
+  int shortHeight = rightTaller ? leftHeight : rightHeight;
+  int height = rightTaller ? rightHeight : leftHeight;
+  AVLNode<Key, Value>* above = nullptr;
+  AVLNode<Key, Value>* current = top;
+  while(height > shortHeight + 1){
+    above = current;
+    if(rightTaller){
+      height -= current->getBalance() > 0 ? 2 : 1;
+      current = current->getLeft();
+    }
+    else{
+      height -= current->getBalance() < 0 ? 2 : 1;
+      current = current->getRight();
+    }
+  }
+
+  // node goes in there, over the short side and what was found
+  node->setParent(above);
+  if(rightTaller){
+    above->setLeft(node);
+    node->setRight(current);
+    node->setBalance(height - shortHeight);
+  }
+  else{
+    above->setRight(node);
+    node->setLeft(current);
+    node->setBalance(shortHeight - height);
+  }
+  if(current != nullptr){
+    current->setParent(node);
+  }
+  this->refreshKeyPrefix(top);
+  this->refreshKeyPrefix(node);
+  this->refreshPath(node);
+
+  // That spot is one taller now; same walk as rebalanceInsert()
+  AVLNode<Key, Value>* child = node;
+  AVLNode<Key, Value>* ancestor = above;
+  while(ancestor != parent){
+    ancestor->updateBalance(child == ancestor->getLeft() ? -1 : 1);
+    if(ancestor->getBalance() == 0){
+      break;
+    }
+    else if(ancestor->getBalance() == 2 || ancestor->getBalance() == -2){
+      insertFix(child, ancestor);
+      break;
+    }
+    child = ancestor;
+    ancestor = ancestor->getParent();
+  }
+}
+
+/**
+* Marks node and its ancestors as stale. It can stop at the first one
+* that already is, since everything above a stale node is stale too.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::markStale(AVLNode<Key, Value>* node)
+{
+  while(node != nullptr && node->getBalance() != STALE_BALANCE){
+    node->setBalance(STALE_BALANCE);
+    node = node->getParent();
+  }
+}
+
+/**
+* Height of a subtree with valid balances: always follow the taller
+* child, so this is O(log n).
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::cleanHeight(AVLNode<Key, Value>* node) const
+{
+  int height = 0;
+  while(node != nullptr){
+    ++height;
+    node = node->getBalance() > 0 ? node->getRight() : node->getLeft();
+  }
+  return height;
+}
+
 template<class Key, class Value>
 void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
@@ -0,0 +1,1317 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <cstdio>
+#include "bst.h"
+#include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "augavlbst.h"
+#include "intervalbst.h"
+#include "journal.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+using namespace std;
+
+// Simple wall clock timer, returns nanoseconds since construction
+struct BenchTimer {
+    chrono::steady_clock::time_point start;
+    BenchTimer() : start(chrono::steady_clock::now()) {}
+    double elapsedNs() const {
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Draws key ranks from a Zipf(s) distribution over [0, n)
+class ZipfGenerator {
+public:
+    ZipfGenerator(size_t n, double s, uint32_t seed) : rng_(seed), uniform_(0.0, 1.0)
+    {
+        cdf_.resize(n);
+        double sum = 0;
+        for(size_t i = 0; i < n; ++i){
+            sum += 1.0 / pow((double)(i + 1), s);
+            cdf_[i] = sum;
+        }
+        for(size_t i = 0; i < n; ++i){
+            cdf_[i] /= sum;
+        }
+    }
+
+    size_t next()
+    {
+        double u = uniform_(rng_);
+        return lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    }
+
+private:
+    mt19937 rng_;
+    uniform_real_distribution<double> uniform_;
+    vector<double> cdf_;
+};
+
+// Builds a trace of lookups. Ranks are mapped through a shuffled key
+// table so the hot keys are spread over the whole key space. Each draw
+// is repeated burst times in a row to model temporal locality.
+vector<uint64_t> makeTrace(const vector<uint64_t>& keys, size_t length, double s, size_t burst, uint32_t seed)
+{
+    vector<uint64_t> trace(length);
+    mt19937 rng(seed);
+    uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+    ZipfGenerator zipf(keys.size(), s > 0 ? s : 1.0, seed);
+    for(size_t i = 0; i < length; i += burst){
+        uint64_t key = (s <= 0) ? keys[pick(rng)] : keys[zipf.next()];
+        for(size_t j = i; j < i + burst && j < length; ++j){
+            trace[j] = key;
+        }
+    }
+    return trace;
+}
+
+// Runs the trace against a tree and returns ns per lookup.
+// The checksum keeps the compiler from dropping the lookups.
+template<typename Tree>
+double timeLookups(Tree& tree, const vector<uint64_t>& trace, uint64_t& checksum)
+{
+    BenchTimer timer;
+    for(size_t i = 0; i < trace.size(); ++i){
+        checksum += tree.find(trace[i])->second;
+    }
+    return timer.elapsedNs() / trace.size();
+}
+
+template<typename Tree>
+void fillTree(Tree& tree, const vector<uint64_t>& keys)
+{
+    for(size_t i = 0; i < keys.size(); ++i){
+        tree.insert(make_pair(keys[i], keys[i] * 2));
+    }
+}
+
+void benchSkewedLookups(size_t numKeys, size_t traceLength)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 7 + 1;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+
+    AVLTree<uint64_t, uint64_t> avl;
+    SplayTree<uint64_t, uint64_t> splay;
+    fillTree(avl, keys);
+    fillTree(splay, keys);
+
+    cout << "Lookups on " << numKeys << " keys, " << traceLength << " lookups per trace (ns/lookup)" << endl;
+    cout << setw(10) << "zipf s" << setw(8) << "burst" << setw(12) << "AVLTree" << setw(12) << "SplayTree" << endl;
+
+    const double skews[] = { 0.0, 0.8, 1.0, 1.2, 1.5, 2.0, 3.0 };
+    const size_t bursts[] = { 1, 4 };
+    uint64_t checksum = 0;
+    for(size_t b = 0; b < sizeof(bursts) / sizeof(bursts[0]); ++b){
+        for(size_t i = 0; i < sizeof(skews) / sizeof(skews[0]); ++i){
+            vector<uint64_t> trace = makeTrace(keys, traceLength, skews[i], bursts[b], 7 + i);
+            double avlNs = timeLookups(avl, trace, checksum);
+            double splayNs = timeLookups(splay, trace, checksum);
+            cout << setw(10) << (skews[i] <= 0 ? string("uniform") : to_string(skews[i]).substr(0, 4))
+                 << setw(8) << bursts[b]
+                 << setw(12) << fixed << setprecision(1) << avlNs
+                 << setw(12) << splayNs << endl;
+        }
+    }
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Counts branch misses of this thread in user space through
+// perf_event_open (Linux only; ok() is false where there's no PMU)
+class BranchMissCounter {
+public:
+    BranchMissCounter() : fd_(-1)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    ~BranchMissCounter()
+    {
+#ifdef __linux__
+        if(fd_ >= 0){
+            close(fd_);
+        }
+#endif
+    }
+
+    bool ok() const { return fd_ >= 0; }
+
+    long long read() const
+    {
+        long long count = 0;
+#ifdef __linux__
+        if(fd_ < 0 || ::read(fd_, &count, sizeof(count)) != sizeof(count)){
+            return 0;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd_;
+};
+
+// A uint64_t that isn't an arithmetic type, so trees keyed on it take
+// the generic (branching) descent
+struct BoxedKey {
+    uint64_t value;
+    bool operator==(const BoxedKey& rhs) const { return value == rhs.value; }
+    bool operator!=(const BoxedKey& rhs) const { return value != rhs.value; }
+    bool operator<(const BoxedKey& rhs) const { return value < rhs.value; }
+    bool operator>(const BoxedKey& rhs) const { return value > rhs.value; }
+};
+
+ostream& operator<<(ostream& os, const BoxedKey& key)
+{
+    return os << key.value;
+}
+
+template<typename Tree, typename K>
+void timeDescent(Tree& tree, const vector<K>& trace, uint64_t& checksum, const BranchMissCounter& misses)
+{
+    long long before = misses.read();
+    BenchTimer timer;
+    for(size_t i = 0; i < trace.size(); ++i){
+        checksum += tree.find(trace[i])->second;
+    }
+    double ns = timer.elapsedNs() / trace.size();
+    cout << setw(12) << fixed << setprecision(1) << ns;
+    if(misses.ok()){
+        cout << setw(10) << setprecision(2) << (double)(misses.read() - before) / trace.size();
+    }
+    else{
+        cout << setw(10) << "n/a";
+    }
+}
+
+void benchBranchlessLookups(size_t numKeys, size_t traceLength)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 7 + 1;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+
+    AVLTree<uint64_t, uint64_t> arithmetic;
+    AVLTree<BoxedKey, uint64_t> generic;
+    for(size_t i = 0; i < numKeys; ++i){
+        arithmetic.insert(make_pair(keys[i], keys[i]));
+        BoxedKey boxed = { keys[i] };
+        generic.insert(make_pair(boxed, keys[i]));
+    }
+
+    BranchMissCounter misses;
+    cout << "Descent on " << numKeys << " uint64 keys (ns/lookup, branch misses/lookup)" << endl;
+    cout << setw(12) << "trace" << setw(12) << "generic" << setw(10) << "misses"
+         << setw(12) << "branchless" << setw(10) << "misses" << endl;
+    uint64_t checksum = 0;
+    for(int pass = 0; pass < 2; ++pass){
+        // Uniform random keys defeat the branch predictor, sorted ones don't
+        vector<uint64_t> trace = makeTrace(keys, traceLength, 0.0, 1, 3);
+        if(pass == 1){
+            sort(trace.begin(), trace.end());
+        }
+        vector<BoxedKey> boxedTrace(trace.size());
+        for(size_t i = 0; i < trace.size(); ++i){
+            boxedTrace[i].value = trace[i];
+        }
+        cout << setw(12) << (pass == 0 ? "random" : "sorted");
+        timeDescent(generic, boxedTrace, checksum, misses);
+        timeDescent(arithmetic, trace, checksum, misses);
+        cout << endl;
+    }
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// The same for std::string, which skips the inline key prefixes
+struct BoxedString {
+    string value;
+    bool operator==(const BoxedString& rhs) const { return value == rhs.value; }
+    bool operator!=(const BoxedString& rhs) const { return value != rhs.value; }
+    bool operator<(const BoxedString& rhs) const { return value < rhs.value; }
+    bool operator>(const BoxedString& rhs) const { return value > rhs.value; }
+};
+
+ostream& operator<<(ostream& os, const BoxedString& key)
+{
+    return os << key.value;
+}
+
+void benchStringKeys(size_t numKeys, size_t traceLength)
+{
+    // URL-like keys: a long shared prefix, the differences at the end
+    vector<string> keys(numKeys);
+    mt19937_64 rng(17);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = "https://www.example.com/catalog/item-" + to_string(rng() % 1000000000) + "/details";
+    }
+    vector<BoxedString> boxed(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        boxed[i].value = keys[i];
+    }
+
+    cout << "URL keys, " << numKeys << " inserts and " << traceLength << " lookups (ns/op)" << endl;
+    cout << setw(14) << "keys" << setw(12) << "insert" << setw(12) << "find" << endl;
+    uint64_t checksum = 0;
+    {
+        AVLTree<BoxedString, uint64_t> tree;
+        BenchTimer insertTimer;
+        for(size_t i = 0; i < numKeys; ++i){
+            tree.insert(make_pair(boxed[i], (uint64_t)i));
+        }
+        double insertNs = insertTimer.elapsedNs() / numKeys;
+        uniform_int_distribution<size_t> pick(0, numKeys - 1);
+        mt19937 traceRng(3);
+        BenchTimer findTimer;
+        for(size_t i = 0; i < traceLength; ++i){
+            checksum += tree.find(boxed[pick(traceRng)])->second;
+        }
+        cout << setw(14) << "generic" << setw(12) << fixed << setprecision(1) << insertNs
+             << setw(12) << findTimer.elapsedNs() / traceLength << endl;
+    }
+    {
+        AVLTree<string, uint64_t> tree;
+        BenchTimer insertTimer;
+        for(size_t i = 0; i < numKeys; ++i){
+            tree.insert(make_pair(keys[i], (uint64_t)i));
+        }
+        double insertNs = insertTimer.elapsedNs() / numKeys;
+        uniform_int_distribution<size_t> pick(0, numKeys - 1);
+        mt19937 traceRng(3);
+        BenchTimer findTimer;
+        for(size_t i = 0; i < traceLength; ++i){
+            checksum -= tree.find(keys[pick(traceRng)])->second;
+        }
+        cout << setw(14) << "prefixed" << setw(12) << fixed << setprecision(1) << insertNs
+             << setw(12) << findTimer.elapsedNs() / traceLength << endl;
+    }
+    // Both sides look up the same keys, so this should be 0
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Lookups on a tree whose nodes were scattered by churn, before and
+// after relayout() packs them in BFS and van Emde Boas order
+void benchRelayout(size_t numKeys, size_t traceLength)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 7 + 1;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < numKeys; ++i){
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    // Replace every key once, in random order, so that neighbours in the
+    // tree end up in unrelated heap chunks
+    mt19937 rng(5);
+    for(size_t i = 0; i < numKeys; ++i){
+        size_t slot = rng() % numKeys;
+        tree.remove(keys[slot]);
+        keys[slot] += 7 * numKeys;
+        tree.insert(make_pair(keys[slot], keys[slot]));
+    }
+    vector<uint64_t> trace = makeTrace(keys, traceLength, 0.0, 1, 3);
+
+    cout << "Relayout of " << numKeys << " churned AVL nodes (ns/lookup)" << endl;
+    cout << setw(12) << "layout" << setw(12) << "relayout ms" << setw(12) << "find" << endl;
+    uint64_t checksum = 0;
+    const char* names[] = { "heap", "bfs", "veb" };
+    for(int pass = 0; pass < 3; ++pass){
+        double relayoutMs = 0;
+        if(pass > 0){
+            BenchTimer relayoutTimer;
+            tree.relayout(pass == 1 ? LAYOUT_BFS : LAYOUT_VEB);
+            relayoutMs = relayoutTimer.elapsedNs() / 1e6;
+        }
+        BenchTimer findTimer;
+        for(size_t i = 0; i < trace.size(); ++i){
+            checksum += tree.find(trace[i])->second;
+        }
+        cout << setw(12) << names[pass] << setw(12) << fixed << setprecision(1) << relayoutMs
+             << setw(12) << findTimer.elapsedNs() / trace.size() << endl;
+    }
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Counting occurrences: find() then insert() of the new count, against
+// upsert() and getOrInsert() doing it in one descent
+void benchUpsert(size_t numKeys, size_t traceLength)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 7 + 1;
+    }
+    // Skewed, so most updates hit keys that are already counted
+    vector<uint64_t> trace = makeTrace(keys, traceLength, 0.8, 1, 9);
+
+    cout << "Counting " << traceLength << " keys drawn from " << numKeys << " (ns/update)" << endl;
+    cout << setw(14) << "method" << setw(12) << "avl" << setw(12) << "red-black" << endl;
+    const char* names[] = { "find+insert", "upsert", "getOrInsert" };
+    uint64_t checksum = 0;
+    for(int method = 0; method < 3; ++method){
+        cout << setw(14) << names[method];
+        for(int kind = 0; kind < 2; ++kind){
+            AVLTree<uint64_t, uint64_t> avl;
+            RedBlackTree<uint64_t, uint64_t> rb;
+            BinarySearchTree<uint64_t, uint64_t>& tree = (kind == 0) ? (BinarySearchTree<uint64_t, uint64_t>&)avl : rb;
+            BenchTimer timer;
+            for(size_t i = 0; i < trace.size(); ++i){
+                if(method == 0){
+                    BinarySearchTree<uint64_t, uint64_t>::iterator it = tree.find(trace[i]);
+                    tree.insert(make_pair(trace[i], it == tree.end() ? (uint64_t)1 : it->second + 1));
+                }
+                else if(method == 1){
+                    tree.upsert(trace[i], [](uint64_t& count){ ++count; });
+                }
+                else{
+                    ++tree.getOrInsert(trace[i], 0);
+                }
+            }
+            cout << setw(12) << fixed << setprecision(1) << timer.elapsedNs() / trace.size();
+            checksum += tree.size();
+        }
+        cout << endl;
+    }
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Dropping every other key in one scan: collecting the keys and calling
+// remove() on each, against erasing through a cursor as the scan goes
+void benchScanErase(size_t numKeys)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 7 + 1;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+
+    cout << "Erasing half of " << numKeys << " keys during a scan (ns/erase)" << endl;
+    cout << setw(12) << "tree" << setw(12) << "remove" << setw(12) << "cursor" << endl;
+    for(int kind = 0; kind < 2; ++kind){
+        double ns[2];
+        for(int pass = 0; pass < 2; ++pass){
+            AVLTree<uint64_t, uint64_t> avl;
+            RedBlackTree<uint64_t, uint64_t> rb;
+            BinarySearchTree<uint64_t, uint64_t>& tree = (kind == 0) ? (BinarySearchTree<uint64_t, uint64_t>&)avl : rb;
+            for(size_t i = 0; i < numKeys; ++i){
+                tree.insert(make_pair(keys[i], keys[i]));
+            }
+            BenchTimer timer;
+            if(pass == 0){
+                vector<uint64_t> doomed;
+                for(BinarySearchTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it){
+                    if(it->first % 2 == 0){
+                        doomed.push_back(it->first);
+                    }
+                }
+                for(size_t i = 0; i < doomed.size(); ++i){
+                    tree.remove(doomed[i]);
+                }
+            }
+            else{
+                BinarySearchTree<uint64_t, uint64_t>::cursor cursor = tree.cursorAt(tree.begin());
+                while(cursor.valid()){
+                    if(cursor.key() % 2 == 0){
+                        cursor.erase();
+                    }
+                    else{
+                        ++cursor;
+                    }
+                }
+            }
+            ns[pass] = timer.elapsedNs() / (numKeys / 2);
+        }
+        cout << setw(12) << (kind == 0 ? "avl" : "red-black") << setw(12) << fixed << setprecision(1) << ns[0]
+             << setw(12) << ns[1] << endl;
+    }
+    cout << endl;
+}
+
+// Expiry-style churn: the oldest key is removed and a fresh one is
+// inserted, so the tree size stays constant. Returns ns per update.
+template<typename Tree>
+double timeExpiryChurn(Tree& tree, const vector<uint64_t>& keys, size_t window)
+{
+    for(size_t i = 0; i < window; ++i){
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    BenchTimer timer;
+    for(size_t i = window; i < keys.size(); ++i){
+        tree.remove(keys[i - window]);
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    return timer.elapsedNs() / (2 * (keys.size() - window));
+}
+
+void benchRemoveHeavy(size_t window, size_t updates)
+{
+    vector<uint64_t> keys(window + updates);
+    mt19937_64 rng(1234);
+    for(size_t i = 0; i < keys.size(); ++i){
+        keys[i] = rng();
+    }
+
+    AVLTree<uint64_t, uint64_t> avl;
+    RedBlackTree<uint64_t, uint64_t> rb;
+    cout << "Expiry churn with " << window << " live keys, " << updates << " remove+insert pairs (ns/update)" << endl;
+    cout << setw(12) << "AVLTree" << setw(14) << "RedBlackTree" << endl;
+    double avlNs = timeExpiryChurn(avl, keys, window);
+    double rbNs = timeExpiryChurn(rb, keys, window);
+    cout << setw(12) << fixed << setprecision(1) << avlNs << setw(14) << rbNs << endl << endl;
+}
+
+// Nearly sorted time-series keys: appends through insert(end(), ...)
+// versus a plain insert, then lookups of a key close to the previous one.
+void benchHintedAppends(size_t numKeys)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 4;
+    }
+
+    AVLTree<uint64_t, uint64_t> plain, hinted;
+    cout << "Appending " << numKeys << " increasing keys (ns/op)" << endl;
+
+    BenchTimer plainTimer;
+    for(size_t i = 0; i < numKeys; ++i){
+        plain.insert(make_pair(keys[i], keys[i]));
+    }
+    double plainNs = plainTimer.elapsedNs() / numKeys;
+
+    BenchTimer hintedTimer;
+    for(size_t i = 0; i < numKeys; ++i){
+        hinted.insert(hinted.end(), make_pair(keys[i], keys[i]));
+    }
+    double hintedNs = hintedTimer.elapsedNs() / numKeys;
+
+    // Walk forward in small random steps, looking each key up from the last hit
+    mt19937 rng(99);
+    uniform_int_distribution<size_t> step(1, 8);
+    vector<uint64_t> trace;
+    for(size_t i = 0; i < numKeys; i += step(rng)){
+        trace.push_back(keys[i]);
+    }
+
+    uint64_t checksum = 0;
+    BenchTimer findTimer;
+    for(size_t i = 0; i < trace.size(); ++i){
+        checksum += plain.find(trace[i])->second;
+    }
+    double findNs = findTimer.elapsedNs() / trace.size();
+
+    AVLTree<uint64_t, uint64_t>::iterator last = hinted.begin();
+    BenchTimer fingerTimer;
+    for(size_t i = 0; i < trace.size(); ++i){
+        last = hinted.find(last, trace[i]);
+        checksum += last->second;
+    }
+    double fingerNs = fingerTimer.elapsedNs() / trace.size();
+
+    cout << setw(22) << "insert(pair)" << setw(12) << fixed << setprecision(1) << plainNs << endl;
+    cout << setw(22) << "insert(end(), pair)" << setw(12) << hintedNs << endl;
+    cout << setw(22) << "find(key)" << setw(12) << findNs << endl;
+    cout << setw(22) << "find(last, key)" << setw(12) << fingerNs << endl;
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// A few keys looked up over and over, with and without the lookup cache
+void benchLookupCache(size_t numKeys, size_t traceLength)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 7 + 1;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+
+    AVLTree<uint64_t, uint64_t> avl;
+    fillTree(avl, keys);
+
+    cout << "Lookup cache on " << numKeys << " keys (ns/lookup)" << endl;
+    cout << setw(10) << "zipf s" << setw(8) << "burst" << setw(12) << "no cache" << setw(12) << "cache" << setw(10) << "hit rate" << endl;
+
+    const double skews[] = { 0.0, 1.2, 2.0 };
+    const size_t bursts[] = { 1, 4 };
+    uint64_t checksum = 0;
+    for(size_t b = 0; b < sizeof(bursts) / sizeof(bursts[0]); ++b){
+        for(size_t i = 0; i < sizeof(skews) / sizeof(skews[0]); ++i){
+            vector<uint64_t> trace = makeTrace(keys, traceLength, skews[i], bursts[b], 11 + i);
+            avl.disableLookupCache();
+            double plainNs = timeLookups(avl, trace, checksum);
+            avl.enableLookupCache(1024);
+            double cachedNs = timeLookups(avl, trace, checksum);
+            cout << setw(10) << (skews[i] <= 0 ? string("uniform") : to_string(skews[i]).substr(0, 4))
+                 << setw(8) << bursts[b]
+                 << setw(12) << fixed << setprecision(1) << plainNs
+                 << setw(12) << cachedNs
+                 << setw(10) << setprecision(2) << avl.lookupCacheStats().hitRate() << endl;
+        }
+    }
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// What latency stats cost per operation, then the distributions they
+// record: one tree per thread, histograms merged at the end
+void benchLatency(size_t numKeys, size_t traceLength)
+{
+    vector<uint64_t> keys(numKeys);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = i * 7 + 1;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+    vector<uint64_t> trace = makeTrace(keys, traceLength, 0, 1, 5);
+
+    cout << "Latency stats on " << numKeys << " keys (ns/op)" << endl;
+    cout << setw(10) << "stats" << setw(12) << "insert" << setw(12) << "find" << setw(12) << "remove" << endl;
+    uint64_t checksum = 0;
+    LatencyStats merged;
+    for(int pass = 0; pass < 2; ++pass){
+        AVLTree<uint64_t, uint64_t> avl;
+        if(pass == 1){
+            avl.enableLatencyStats();
+        }
+        BenchTimer insertTimer;
+        fillTree(avl, keys);
+        double insertNs = insertTimer.elapsedNs() / numKeys;
+        double findNs = timeLookups(avl, trace, checksum);
+        BenchTimer removeTimer;
+        for(size_t i = 0; i < numKeys; i += 2){
+            avl.remove(keys[i]);
+        }
+        double removeNs = removeTimer.elapsedNs() / ((numKeys + 1) / 2);
+        cout << setw(10) << (pass == 0 ? "off" : "on") << setw(12) << fixed << setprecision(1) << insertNs
+             << setw(12) << findNs << setw(12) << removeNs << endl;
+        merged.merge(avl.latencyStats());
+    }
+
+    // Two more trees filled and searched from their own threads
+    LatencyStats perThread[2];
+    uint64_t sums[2] = { 0, 0 };
+    vector<thread> workers;
+    for(int t = 0; t < 2; ++t){
+        workers.push_back(thread([&, t]() {
+            AVLTree<uint64_t, uint64_t> avl;
+            avl.enableLatencyStats();
+            fillTree(avl, keys);
+            for(size_t i = t; i < trace.size(); i += 2){
+                sums[t] += avl.find(trace[i])->second;
+            }
+            perThread[t] = avl.latencyStats();
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t){
+        workers[t].join();
+        merged.merge(perThread[t]);
+        checksum += sums[t];
+    }
+    merged.writeText(cout);
+    merged.writeJson(cout);
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Sums over random key ranges: an iterator walk over a plain AVLTree
+// versus rangeAggregate() on the augmented tree
+void benchRangeSums(size_t numKeys, size_t queries)
+{
+    AVLTree<uint64_t, uint64_t> plain;
+    AugmentedAVLTree<uint64_t, uint64_t> augmented;
+    for(size_t i = 0; i < numKeys; ++i){
+        plain.insert(plain.end(), make_pair((uint64_t)i, (uint64_t)i));
+        augmented.insert(augmented.end(), make_pair((uint64_t)i, (uint64_t)i));
+    }
+
+    cout << "Range sums on " << numKeys << " keys (ns/query)" << endl;
+    cout << setw(12) << "range" << setw(14) << "iterator" << setw(16) << "rangeAggregate" << endl;
+
+    const size_t widths[] = { 10, 1000, 100000 };
+    uint64_t checksum = 0;
+    for(size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w){
+        size_t width = min(widths[w], numKeys);
+        mt19937 rng(5 + w);
+        uniform_int_distribution<uint64_t> pick(0, numKeys - width);
+        vector<uint64_t> starts(queries);
+        for(size_t i = 0; i < queries; ++i){
+            starts[i] = pick(rng);
+        }
+
+        BenchTimer walkTimer;
+        for(size_t i = 0; i < queries; ++i){
+            uint64_t hi = starts[i] + width - 1;
+            for(AVLTree<uint64_t, uint64_t>::iterator it = plain.find(starts[i]); it != plain.end() && it->first <= hi; ++it){
+                checksum += it->second;
+            }
+        }
+        double walkNs = walkTimer.elapsedNs() / queries;
+
+        BenchTimer aggTimer;
+        for(size_t i = 0; i < queries; ++i){
+            checksum -= augmented.rangeAggregate(starts[i], starts[i] + width - 1);
+        }
+        double aggNs = aggTimer.elapsedNs() / queries;
+
+        cout << setw(12) << width << setw(14) << fixed << setprecision(1) << walkNs << setw(16) << aggNs << endl;
+    }
+    // Both sides add up the same ranges, so this should be 0
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Reservations [start, start + length) and windows that overlap a few of
+// them: a full scan over the tree versus IntervalTree::overlapping()
+void benchIntervalOverlaps(size_t numIntervals, size_t queries)
+{
+    IntervalTree<uint64_t, uint64_t> tree;
+    mt19937_64 rng(77);
+    uint64_t span = numIntervals * 10;
+    for(size_t i = 0; i < numIntervals; ++i){
+        uint64_t start = rng() % span;
+        tree.insert(make_pair(Interval<uint64_t>(start, start + 1 + rng() % 100), (uint64_t)i));
+    }
+
+    vector<uint64_t> windows(queries);
+    for(size_t i = 0; i < queries; ++i){
+        windows[i] = rng() % span;
+    }
+
+    // The scan is O(n) per query, so it only gets a few of them
+    size_t scanQueries = min(queries, (size_t)20);
+    uint64_t checksum = 0;
+    BenchTimer scanTimer;
+    for(size_t i = 0; i < scanQueries; ++i){
+        for(IntervalTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it){
+            if(it->first.start < windows[i] + 50 && windows[i] < it->first.end){
+                checksum += it->second;
+            }
+        }
+    }
+    double scanNs = scanTimer.elapsedNs() / scanQueries;
+
+    BenchTimer treeTimer;
+    size_t found = 0;
+    for(size_t i = 0; i < queries; ++i){
+        vector<IntervalTree<uint64_t, uint64_t>::iterator> hits = tree.overlapping(windows[i], windows[i] + 50);
+        found += hits.size();
+        for(size_t j = 0; j < hits.size(); ++j){
+            checksum += hits[j]->second;
+        }
+    }
+    double treeNs = treeTimer.elapsedNs() / queries;
+
+    cout << "Overlap queries on " << numIntervals << " intervals, "
+         << fixed << setprecision(1) << (double)found / queries << " hits per query (ns/query)" << endl;
+    cout << setw(12) << "full scan" << setw(14) << "overlapping" << endl;
+    cout << setw(12) << scanNs << setw(14) << treeNs << endl;
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Stabbing cost against the number of hits k and the tree size n. The
+// short intervals all end before the query points, and the k long ones
+// that contain them start anywhere among them, so a walk down the
+// interval tree itself would pay about log(n / k) per hit; the index
+// should cost the same per hit at any n.
+void benchStabbingCost(size_t numIntervals, size_t queries)
+{
+    cout << "Stabbing queries, k long intervals among n short ones (ns/query, ns/hit)" << endl;
+    cout << setw(10) << "n" << setw(8) << "k" << setw(12) << "query" << setw(10) << "hit" << endl;
+    size_t sizes[] = { numIntervals / 100, numIntervals / 10, numIntervals };
+    size_t hitCounts[] = { 1, 16, 256, 4096 };
+    uint64_t checksum = 0;
+    for(size_t n : sizes){
+        for(size_t k : hitCounts){
+            if(n < 1000 || (k > 16 && n != numIntervals)){
+                continue;
+            }
+            IntervalTree<uint64_t, uint64_t> tree;
+            mt19937_64 rng(91);
+            uint64_t half = n * 10;
+            for(size_t i = 0; i < n; ++i){
+                uint64_t start = rng() % (half - 10);
+                tree.insert(make_pair(Interval<uint64_t>(start, start + 1 + rng() % 8), (uint64_t)i));
+            }
+            for(size_t i = 0; i < k; ++i){
+                tree.insert(make_pair(Interval<uint64_t>(rng() % half, 2 * half), (uint64_t)i));
+            }
+
+            BenchTimer timer;
+            for(size_t i = 0; i < queries; ++i){
+                vector<IntervalTree<uint64_t, uint64_t>::iterator> hits = tree.stabbing(half + rng() % half);
+                checksum += hits.size();
+            }
+            double queryNs = timer.elapsedNs() / queries;
+            cout << setw(10) << n << setw(8) << k << setw(12) << fixed << setprecision(1) << queryNs
+                 << setw(10) << queryNs / k << endl;
+        }
+    }
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Several values per key: a std::vector inside each value versus
+// multimap mode with one node per value. Tree values have to be
+// printable, hence the wrapper.
+struct ValueList {
+    vector<uint64_t> items;
+};
+
+ostream& operator<<(ostream& os, const ValueList& list)
+{
+    return os << list.items.size() << " items";
+}
+
+void benchDuplicateKeys(size_t numItems, size_t perKey)
+{
+    mt19937_64 rng(21);
+    size_t numKeys = max(numItems / perKey, (size_t)1);
+    vector<uint64_t> keys(numItems);
+    for(size_t i = 0; i < numItems; ++i){
+        keys[i] = rng() % numKeys;
+    }
+
+    uint64_t checksum = 0;
+    BenchTimer vectorTimer;
+    {
+        AVLTree<uint64_t, ValueList> tree;
+        for(size_t i = 0; i < numItems; ++i){
+            AVLTree<uint64_t, ValueList>::iterator it = tree.find(keys[i]);
+            if(it == tree.end()){
+                ValueList list;
+                list.items.push_back(i);
+                tree.insert(make_pair(keys[i], list));
+            }
+            else{
+                it->second.items.push_back(i);
+            }
+        }
+        for(size_t k = 0; k < numKeys; ++k){
+            AVLTree<uint64_t, ValueList>::iterator it = tree.find(k);
+            if(it != tree.end()){
+                checksum += it->second.items.size();
+            }
+        }
+    }
+    double vectorNs = vectorTimer.elapsedNs() / numItems;
+
+    BenchTimer multiTimer;
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        tree.setMultimap(true);
+        for(size_t i = 0; i < numItems; ++i){
+            tree.insert(make_pair(keys[i], (uint64_t)i));
+        }
+        for(size_t k = 0; k < numKeys; ++k){
+            checksum -= tree.count(k);
+        }
+    }
+    double multiNs = multiTimer.elapsedNs() / numItems;
+
+    cout << "Duplicate keys: " << numItems << " items, ~" << perKey << " per key (ns/item, insert + count + free)" << endl;
+    cout << setw(16) << "vector values" << setw(12) << "multimap" << endl;
+    cout << setw(16) << fixed << setprecision(1) << vectorNs << setw(12) << multiNs << endl;
+    // Both count the same items, so this should be 0
+    cout << "(checksum " << checksum << ")" << endl << endl;
+}
+
+// Expiry sweep: half of the keys are removed back to back, with remove()
+// and with lazyRemove(). The compaction that frees the tombstones is
+// timed on its own, since it can run after the sweep has finished.
+template<typename Tree>
+void timeSweep(const vector<uint64_t>& keys, const vector<uint64_t>& expired, const char* name)
+{
+    Tree plain, lazy;
+    fillTree(plain, keys);
+    fillTree(lazy, keys);
+    lazy.setCompactThreshold(0);
+
+    BenchTimer removeTimer;
+    for(size_t i = 0; i < expired.size(); ++i){
+        plain.remove(expired[i]);
+    }
+    double removeNs = removeTimer.elapsedNs() / expired.size();
+
+    BenchTimer lazyTimer;
+    for(size_t i = 0; i < expired.size(); ++i){
+        lazy.lazyRemove(expired[i]);
+    }
+    double lazyNs = lazyTimer.elapsedNs() / expired.size();
+
+    BenchTimer compactTimer;
+    lazy.compact();
+    double compactNs = compactTimer.elapsedNs() / expired.size();
+
+    cout << setw(14) << name << setw(10) << fixed << setprecision(1) << removeNs
+         << setw(12) << lazyNs << setw(10) << compactNs << endl;
+}
+
+void benchExpirySweep(size_t numKeys)
+{
+    vector<uint64_t> keys(numKeys);
+    mt19937_64 rng(31);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = rng();
+    }
+    vector<uint64_t> expired(keys.begin(), keys.begin() + numKeys / 2);
+    vector<uint64_t> oldest(keys);
+    sort(oldest.begin(), oldest.end());
+    oldest.resize(numKeys / 2);
+
+    cout << "Expiry sweep removing " << numKeys / 2 << " of " << numKeys << " keys (ns/remove, compact amortized)" << endl;
+    cout << setw(14) << "random order" << setw(10) << "remove" << setw(12) << "lazyRemove" << setw(10) << "compact" << endl;
+    timeSweep<AVLTree<uint64_t, uint64_t> >(keys, expired, "AVLTree");
+    timeSweep<RedBlackTree<uint64_t, uint64_t> >(keys, expired, "RedBlackTree");
+    cout << setw(14) << "oldest first" << endl;
+    timeSweep<AVLTree<uint64_t, uint64_t> >(keys, oldest, "AVLTree");
+    timeSweep<RedBlackTree<uint64_t, uint64_t> >(keys, oldest, "RedBlackTree");
+    cout << endl;
+}
+
+// Time-window expiry: keys are timestamps, and every step appends a
+// block of new ones and expires the oldest block, one remove() per key
+// or one removeRange(). Also reports the slowest single expiry.
+void benchRangeExpiry(size_t numKeys, size_t block)
+{
+    cout << "Expiring blocks of " << block << " from a window of " << numKeys << " (ns/key, worst expiry us)" << endl;
+    cout << setw(14) << "method" << setw(12) << "ns/key" << setw(12) << "worst us" << endl;
+    for(int method = 0; method < 2; ++method){
+        AVLTree<uint64_t, uint64_t> tree;
+        uint64_t next = 0;
+        for(; next < numKeys; ++next){
+            tree.insert(tree.end(), make_pair(next, next));
+        }
+        uint64_t oldest = 0;
+        double totalNs = 0;
+        double worstNs = 0;
+        size_t steps = max((size_t)1, numKeys / block);
+        for(size_t step = 0; step < steps; ++step){
+            for(size_t i = 0; i < block; ++i, ++next){
+                tree.insert(tree.end(), make_pair(next, next));
+            }
+            BenchTimer timer;
+            if(method == 0){
+                for(size_t i = 0; i < block; ++i){
+                    tree.remove(oldest + i);
+                }
+            }
+            else{
+                tree.removeRange(oldest, oldest + block - 1);
+            }
+            double ns = timer.elapsedNs();
+            totalNs += ns;
+            worstNs = max(worstNs, ns);
+            oldest += block;
+        }
+        cout << setw(14) << (method == 0 ? "remove" : "removeRange") << setw(12) << fixed << setprecision(1)
+             << totalNs / (steps * block) << setw(12) << worstNs / 1000 << endl;
+    }
+    cout << endl;
+}
+
+// Full-tree sum: iterator loop versus parallelReduce() on pools of
+// increasing size
+void benchParallelScan(size_t numKeys)
+{
+    vector<uint64_t> keys(numKeys);
+    mt19937_64 rng(41);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = rng();
+    }
+    AVLTree<uint64_t, uint64_t> tree;
+    fillTree(tree, keys);
+
+    BenchTimer seqTimer;
+    uint64_t expected = 0;
+    for(AVLTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it){
+        expected += it->second;
+    }
+    double seqMs = seqTimer.elapsedNs() / 1e6;
+
+    cout << "Summing " << numKeys << " values (ms, " << thread::hardware_concurrency() << " hardware threads)" << endl;
+    cout << setw(12) << "iterator" << setw(12) << fixed << setprecision(2) << seqMs << endl;
+
+    size_t maxThreads = max(4u, thread::hardware_concurrency());
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+        WorkStealingPool pool(threads);
+        BenchTimer timer;
+        uint64_t sum = tree.parallelReduce((uint64_t)0,
+            [](const pair<const uint64_t, uint64_t>& item) { return item.second; },
+            [](uint64_t a, uint64_t b) { return a + b; }, false, pool);
+        double ms = timer.elapsedNs() / 1e6;
+        cout << setw(12) << (to_string(threads) + " threads") << setw(12) << ms
+             << (sum == expected ? "" : "  MISMATCH") << endl;
+    }
+    cout << endl;
+}
+
+// Building a tree from an unsorted dump: one insert per item versus
+// buildParallel() on pools of increasing size
+void benchBulkLoad(size_t numKeys)
+{
+    vector<pair<uint64_t, uint64_t> > dump(numKeys);
+    mt19937_64 rng(51);
+    for(size_t i = 0; i < numKeys; ++i){
+        dump[i] = make_pair(rng(), (uint64_t)i);
+    }
+
+    cout << "Building a tree from " << numKeys << " unsorted items (ms)" << endl;
+    {
+        BenchTimer timer;
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < numKeys; ++i){
+            tree.insert(dump[i]);
+        }
+        cout << setw(14) << "insert loop" << setw(12) << fixed << setprecision(1) << timer.elapsedNs() / 1e6 << endl;
+    }
+
+    size_t maxThreads = max(4u, thread::hardware_concurrency());
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+        WorkStealingPool pool(threads);
+        BenchTimer timer;
+        AVLTree<uint64_t, uint64_t> tree;
+        tree.buildParallel(dump.begin(), dump.end(), pool);
+        cout << setw(14) << (to_string(threads) + " threads") << setw(12) << timer.elapsedNs() / 1e6 << endl;
+    }
+    cout << endl;
+}
+
+void benchExportImport(size_t numKeys)
+{
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < numKeys; ++i){
+        tree.insert(tree.end(), make_pair((uint64_t)i, (uint64_t)i));
+    }
+
+    cout << "Copying " << numKeys << " items out of and back into a tree (ms)" << endl;
+    vector<pair<uint64_t, uint64_t> > items;
+    {
+        BenchTimer timer;
+        items.reserve(numKeys);
+        for(AVLTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it){
+            items.push_back(make_pair(it->first, it->second));
+        }
+        cout << setw(14) << "iterator" << setw(12) << fixed << setprecision(1) << timer.elapsedNs() / 1e6 << endl;
+    }
+    {
+        BenchTimer timer;
+        tree.exportItems(&items[0], items.size());
+        cout << setw(14) << "exportItems" << setw(12) << timer.elapsedNs() / 1e6 << endl;
+    }
+    {
+        BenchTimer timer;
+        AVLTree<uint64_t, uint64_t> copy;
+        for(size_t i = 0; i < items.size(); ++i){
+            copy.insert(items[i]);
+        }
+        cout << setw(14) << "insert" << setw(12) << timer.elapsedNs() / 1e6 << endl;
+    }
+    {
+        BenchTimer timer;
+        AVLTree<uint64_t, uint64_t> copy;
+        for(size_t i = 0; i < items.size(); ++i){
+            copy.insert(copy.end(), items[i]);
+        }
+        cout << setw(14) << "hinted insert" << setw(12) << timer.elapsedNs() / 1e6 << endl;
+    }
+    {
+        BenchTimer timer;
+        AVLTree<uint64_t, uint64_t> copy;
+        copy.importSorted(&items[0], items.size());
+        cout << setw(14) << "importSorted" << setw(12) << timer.elapsedNs() / 1e6 << endl;
+    }
+    cout << endl;
+}
+
+void benchMerge(size_t numKeys)
+{
+    // Base and delta are the same size; a quarter of the delta's keys
+    // are already in the base
+    vector<pair<uint64_t, uint64_t> > delta(numKeys);
+    mt19937_64 rng(38);
+    for(size_t i = 0; i < numKeys; ++i){
+        uint64_t key = (i % 4 == 0) ? (rng() % numKeys) * 2 : rng() | 1;
+        delta[i] = make_pair(key, (uint64_t)i);
+    }
+
+    cout << "Merging a " << numKeys << " item delta into a " << numKeys << " item tree (ms)" << endl;
+    for(int pass = 0; pass < 2; ++pass){
+        AVLTree<uint64_t, uint64_t> base;
+        AVLTree<uint64_t, uint64_t> other;
+        for(size_t i = 0; i < numKeys; ++i){
+            base.insert(base.end(), make_pair((uint64_t)i * 2, (uint64_t)i));
+        }
+        for(size_t i = 0; i < numKeys; ++i){
+            other.insert(delta[i]);
+        }
+
+        BenchTimer timer;
+        if(pass == 0){
+            for(AVLTree<uint64_t, uint64_t>::iterator it = other.begin(); it != other.end(); ++it){
+                base.insert(*it);
+            }
+            other.clear();
+        }
+        else{
+            base.merge(other);
+        }
+        cout << setw(14) << (pass == 0 ? "insert loop" : "merge") << setw(12) << fixed << setprecision(1)
+             << timer.elapsedNs() / 1e6 << endl;
+    }
+    cout << endl;
+}
+
+void benchBatchWrites(size_t numKeys, size_t batchSize)
+{
+    vector<uint64_t> keys(numKeys);
+    mt19937_64 rng(40);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = rng();
+    }
+
+    cout << "Inserts in batches of " << batchSize << " up to " << numKeys << " keys (ns per insert)" << endl;
+    const char* names[] = { "random", "random batch", "append", "append batch" };
+    for(int pass = 0; pass < 4; ++pass){
+        bool batched = pass % 2 == 1;
+        bool append = pass >= 2;
+        AVLTree<uint64_t, uint64_t> tree;
+        BenchTimer timer;
+        for(size_t i = 0; i < numKeys; i += batchSize){
+            if(batched){
+                tree.beginBatch();
+            }
+            for(size_t j = i; j < min(numKeys, i + batchSize); ++j){
+                if(append){
+                    tree.insert(tree.end(), make_pair((uint64_t)j, (uint64_t)j));
+                }
+                else{
+                    tree.insert(make_pair(keys[j], (uint64_t)j));
+                }
+            }
+            if(batched){
+                tree.endBatch();
+            }
+        }
+        cout << setw(14) << names[pass] << setw(12) << fixed << setprecision(1) << timer.elapsedNs() / numKeys << endl;
+    }
+    cout << endl;
+}
+
+void benchShape(size_t numKeys)
+{
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < numKeys; ++i){
+        tree.insert(tree.end(), make_pair((uint64_t)i, (uint64_t)i));
+    }
+
+    cout << "Shape checks over " << numKeys << " nodes (ms)" << endl;
+    {
+        BenchTimer timer;
+        TreeShape shape = tree.shape();
+        cout << setw(14) << "shape" << setw(12) << fixed << setprecision(1) << timer.elapsedNs() / 1e6
+             << "   (leaf depths " << shape.minLeafDepth << ".." << shape.maxLeafDepth << ")" << endl;
+    }
+    size_t maxThreads = max(4u, thread::hardware_concurrency());
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+        WorkStealingPool pool(threads);
+        BenchTimer timer;
+        tree.shape(pool);
+        double shapeMs = timer.elapsedNs() / 1e6;
+        BenchTimer equalTimer;
+        bool equal = tree.equalPaths(pool);
+        cout << setw(14) << (to_string(threads) + " threads") << setw(12) << shapeMs
+             << "   equalPaths " << equal << " in " << equalTimer.elapsedNs() / 1e6 << endl;
+    }
+    cout << endl;
+}
+
+template<typename Tree>
+void printMemory(const char* name, const Tree& tree)
+{
+    MemoryUsage usage = tree.memoryUsage();
+    double n = usage.nodes == 0 ? 1.0 : (double)usage.nodes;
+    cout << setw(14) << name << setw(10) << fixed << setprecision(1) << usage.nodeBytes / n
+         << setw(10) << usage.slackBytes / n << setw(10) << usage.valueBytes / n
+         << setw(10) << usage.bytesPerNode() << endl;
+}
+
+void benchMemory(size_t numKeys)
+{
+    vector<uint64_t> keys(numKeys);
+    mt19937_64 rng(91);
+    for(size_t i = 0; i < numKeys; ++i){
+        keys[i] = rng();
+    }
+
+    cout << "Memory for " << numKeys << " uint64 -> uint64 entries (bytes per entry)" << endl;
+    cout << setw(14) << "tree" << setw(10) << "node" << setw(10) << "slack" << setw(10) << "deep"
+         << setw(10) << "total" << endl;
+    {
+        BinarySearchTree<uint64_t, uint64_t> tree;
+        fillTree(tree, keys);
+        printMemory("BST", tree);
+    }
+    {
+        SplayTree<uint64_t, uint64_t> tree;
+        fillTree(tree, keys);
+        printMemory("Splay", tree);
+    }
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        fillTree(tree, keys);
+        printMemory("AVL", tree);
+    }
+    {
+        RedBlackTree<uint64_t, uint64_t> tree;
+        fillTree(tree, keys);
+        printMemory("RedBlack", tree);
+    }
+    {
+        AugmentedAVLTree<uint64_t, uint64_t> tree;
+        fillTree(tree, keys);
+        printMemory("AugmentedAVL", tree);
+    }
+    {
+        IntervalTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < numKeys; ++i){
+            tree.insert(make_pair(Interval<uint64_t>(keys[i], keys[i] + 1), keys[i]));
+        }
+        printMemory("Interval", tree);
+    }
+    {
+        // 40-character strings live outside the node, the sizer counts them
+        AVLTree<uint64_t, string> tree;
+        tree.setValueSizer([](const uint64_t&, const string& value) -> size_t {
+            return value.capacity() > 15 ? value.capacity() + 1 + mallocSlack(value.capacity() + 1) : 0;
+        });
+        for(size_t i = 0; i < numKeys; ++i){
+            tree.insert(make_pair(keys[i], string(40, 'x')));
+        }
+        printMemory("AVL string", tree);
+    }
+    cout << endl;
+}
+
+// Counts the bytes written to it and throws them away
+struct CountingBuf : public std::streambuf
+{
+    CountingBuf() : bytes(0) { }
+    int overflow(int c) { ++bytes; return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) { bytes += n; return n; }
+    size_t bytes;
+};
+
+void benchExport(size_t numKeys)
+{
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < numKeys; ++i){
+        tree.insert(tree.end(), make_pair((uint64_t)i, (uint64_t)i));
+    }
+
+    cout << "Streaming export of " << numKeys << " nodes (ms, bytes per node)" << endl;
+    ExportOptions top;
+    top.maxDepth = 10;
+    for(int pass = 0; pass < 4; ++pass){
+        CountingBuf buf;
+        ostream out(&buf);
+        BenchTimer timer;
+        if(pass % 2 == 0){
+            tree.exportDot(out, pass < 2 ? ExportOptions() : top);
+        }
+        else{
+            tree.exportJson(out, pass < 2 ? ExportOptions() : top);
+        }
+        const char* names[] = { "dot", "json", "dot depth 10", "json depth 10" };
+        cout << setw(14) << names[pass] << setw(12) << fixed << setprecision(1) << timer.elapsedNs() / 1e6
+             << setw(12) << (double)buf.bytes / numKeys << endl;
+    }
+    cout << endl;
+}
+
+void benchJournal(size_t numUpdates)
+{
+    cout << "Durable updates, " << numUpdates << " inserts (us per update)" << endl;
+    // Waiting for every update alone vs letting the flusher group them
+    for(int pass = 0; pass < 2; ++pass){
+        std::remove("bst-bench.log");
+        std::remove("bst-bench.snap");
+        AVLTree<uint64_t, uint64_t> tree;
+        Journal<uint64_t, uint64_t> journal(tree, "bst-bench.log", "bst-bench.snap", chrono::milliseconds(2));
+        BenchTimer timer;
+        for(size_t i = 0; i < numUpdates; ++i){
+            journal.insert(make_pair((uint64_t)i, (uint64_t)i));
+            if(pass == 0){
+                journal.sync();
+            }
+        }
+        journal.sync();
+        cout << setw(14) << (pass == 0 ? "fsync each" : "group commit") << setw(12) << fixed << setprecision(2)
+             << timer.elapsedNs() / 1e3 / numUpdates << endl;
+    }
+    std::remove("bst-bench.log");
+    std::remove("bst-bench.snap");
+    cout << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t numKeys = 1000000;
+    size_t traceLength = 2000000;
+    if(argc > 1){
+        numKeys = strtoul(argv[1], NULL, 10);
+    }
+    if(argc > 2){
+        traceLength = strtoul(argv[2], NULL, 10);
+    }
+
+    benchSkewedLookups(numKeys, traceLength);
+    benchBranchlessLookups(numKeys, traceLength);
+    benchStringKeys(numKeys, traceLength);
+    benchRemoveHeavy(numKeys, traceLength);
+    benchScanErase(numKeys);
+    benchUpsert(numKeys, traceLength);
+    benchHintedAppends(numKeys);
+    benchLookupCache(numKeys, traceLength);
+    benchLatency(numKeys, traceLength);
+    benchRelayout(numKeys, traceLength);
+    benchRangeSums(numKeys, 10000);
+    benchIntervalOverlaps(numKeys, 10000);
+    benchStabbingCost(numKeys, 2000);
+    benchDuplicateKeys(numKeys, 4);
+    benchExpirySweep(numKeys);
+    benchRangeExpiry(numKeys, 1000);
+    benchRangeExpiry(numKeys, numKeys / 10);
+    benchParallelScan(numKeys);
+    benchBulkLoad(numKeys);
+    benchExportImport(numKeys);
+    benchMerge(numKeys);
+    benchBatchWrites(numKeys, 1000);
+    benchBatchWrites(numKeys, numKeys);
+    benchShape(numKeys);
+    benchExport(numKeys);
+    benchMemory(numKeys);
+    benchJournal(min(numKeys, (size_t)2000));
+
+    return 0;
+}
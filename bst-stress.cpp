@@ -0,0 +1,106 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include "bst.h"
+#include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+
+using namespace std;
+
+// Stress test for the iterative internals: builds trees with millions of
+// nodes, including a completely degenerate (linked list shaped) BST, and
+// runs every operation that used to recurse over them.
+// Usage: ./bst-stress [numNodes]   (default 1000000, try 10000000)
+
+void stressDegenerateBST(size_t n)
+{
+    BinarySearchTree<size_t, size_t> bt;
+    // Sorted keys through the hinted insert -> one long right spine
+    for(size_t i = 0; i < n; ++i) {
+        bt.insert(bt.end(), std::make_pair(i, i));
+    }
+    cout << "Degenerate BST with " << n << " nodes" << endl;
+    cout << "  balanced: " << bt.isBalanced() << endl;
+
+    size_t count = 0;
+    for(BinarySearchTree<size_t, size_t>::iterator it = bt.begin(); it != bt.end(); ++it) {
+        ++count;
+    }
+    cout << "  iterated: " << count << endl;
+
+    if(bt.find(n - 1) != bt.end()) {
+        cout << "  found deepest key" << endl;
+    }
+    bt.remove(0);
+    bt.remove(n / 2);
+    bt.remove(n - 1);
+    cout << "  removed root, middle and deepest key" << endl;
+    bt.clear();
+    cout << "  cleared: " << bt.empty() << endl;
+}
+
+template<typename Tree>
+void stressBalanced(Tree& tree, const char* name, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(tree.end(), std::make_pair(i, i));
+    }
+    // Remove every other key, front to back
+    for(size_t i = 0; i < n; i += 2) {
+        tree.remove(i);
+    }
+    cout << name << " after " << n << " inserts and " << (n + 1) / 2 << " removes" << endl;
+    cout << "  balanced: " << tree.isBalanced() << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    stressDegenerateBST(n);
+
+    AVLTree<size_t, size_t> at;
+    stressBalanced(at, "AVLTree", n);
+
+    RedBlackTree<size_t, size_t> rt;
+    stressBalanced(rt, "RedBlackTree", n);
+
+    // Sorted inserts leave a splay tree as one long left spine, so the
+    // first lookup of the smallest key splays through all of it
+    SplayTree<size_t, size_t> st;
+    for(size_t i = 0; i < n; ++i) {
+        st.insert(std::make_pair(i, i));
+    }
+    if(st.find((size_t)0) != st.end()) {
+        cout << "SplayTree splayed smallest of " << n << " keys" << endl;
+    }
+    cout << "  balanced: " << st.isBalanced() << endl;
+
+    // Another left spine, this one freed by the destructor
+    SplayTree<size_t, size_t> lt;
+    for(size_t i = 0; i < n; ++i) {
+        lt.insert(std::make_pair(i, i));
+    }
+    cout << "Left spine balanced: " << lt.isBalanced() << endl;
+
+    // The same spine with std::string keys, whose rotations also update
+    // the nodes' inline key prefixes
+    SplayTree<std::string, size_t> sst;
+    char key[32];
+    for(size_t i = 0; i < n; ++i) {
+        snprintf(key, sizeof(key), "key%012zu", i);
+        sst.insert(std::make_pair(std::string(key), i));
+    }
+    snprintf(key, sizeof(key), "key%012zu", (size_t)0);
+    if(sst.find(std::string(key)) != sst.end()) {
+        cout << "String SplayTree splayed smallest of " << n << " keys" << endl;
+    }
+    cout << "  balanced: " << sst.isBalanced() << endl;
+
+    return 0;
+}
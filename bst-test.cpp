@@ -1,7 +1,17 @@
 #include <iostream>
 #include <map>
+#include <string>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
 #include "bst.h"
 #include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "augavlbst.h"
+#include "intervalbst.h"
+#include "journal.h"
 
 using namespace std;
 
@@ -44,5 +54,492 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Hinted insert / finger search
+    AVLTree<int,int> ht;
+    for(int i = 1; i <= 10; ++i) {
+        ht.insert(ht.end(), std::make_pair(i * 10, i));
+    }
+    AVLTree<int,int>::iterator hint = ht.find(50);
+    ht.insert(hint, std::make_pair(55, 0));
+    cout << "\nHinted AVLTree contents:" << endl;
+    for(AVLTree<int,int>::iterator it = ht.begin(); it != ht.end(); ++it) {
+        cout << it->first << " ";
+    }
+    cout << endl;
+    if(ht.find(hint, 60) != ht.end()) {
+        cout << "Found 60 near 50" << endl;
+    }
+    if(ht.find(ht.end(), 95) == ht.end()) {
+        cout << "Did not find 95" << endl;
+    }
+    cout << "Balanced: " << ht.isBalanced() << endl;
+
+    // Lookup cache
+    ht.enableLookupCache(8);
+    for(int i = 0; i < 4; ++i) {
+        ht.find(30);
+        ht.find(60);
+    }
+    ht.remove(30);
+    if(ht.find(30) == ht.end()) {
+        cout << "Did not find removed 30" << endl;
+    }
+    LookupCacheStats stats = ht.lookupCacheStats();
+    cout << "Lookup cache hits: " << stats.hits << " misses: " << stats.misses << endl;
+
+    // Splay Tree Tests
+    SplayTree<char,int> st;
+    st.insert(std::make_pair('a',1));
+    st.insert(std::make_pair('b',2));
+    st.insert(std::make_pair('c',3));
+
+    cout << "\nSplayTree contents:" << endl;
+    for(SplayTree<char,int>::iterator it = st.begin(); it != st.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    if(st.find('a') != st.end()) {
+        cout << "Found a" << endl;
+    }
+    else {
+        cout << "Did not find a" << endl;
+    }
+    cout << "Tree after splaying a:" << endl;
+    st.print();
+    cout << "Erasing b" << endl;
+    st.remove('b');
+    cout << "st['c'] = " << st['c'] << endl;
+
+    // Red-Black Tree Tests
+    RedBlackTree<char,int> rt;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        rt.insert(std::make_pair(c, c - 'a' + 1));
+    }
+
+    cout << "\nRedBlackTree contents:" << endl;
+    for(RedBlackTree<char,int>::iterator it = rt.begin(); it != rt.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Erasing d and a" << endl;
+    rt.remove('d');
+    rt.remove('a');
+    if(rt.find('d') != rt.end()) {
+        cout << "Found d" << endl;
+    }
+    else {
+        cout << "Did not find d" << endl;
+    }
+    cout << "Valid red-black tree: " << rt.isValid() << endl;
+    RedBlackTree<int,int> rbChurn;
+    for(int i = 0; i < 200; ++i) {
+        rbChurn.insert(std::make_pair((i * 37) % 200, i));
+    }
+    for(int i = 0; i < 200; i += 3) {
+        rbChurn.remove((i * 11) % 200);
+    }
+    cout << "After 200 inserts and " << 200 - rbChurn.size() << " removes, valid red-black tree: " << rbChurn.isValid() << endl;
+
+    // Augmented AVL Tree Tests
+    AugmentedAVLTree<int,int> sums;
+    AugmentedAVLTree<int,int,MaxAugment<int,int> > maxes;
+    for(int i = 1; i <= 10; ++i) {
+        sums.insert(std::make_pair(i * 10, i));
+        maxes.insert(std::make_pair(i * 10, (i * 7) % 11));
+    }
+    cout << "\nSum of all values: " << sums.aggregate() << endl;
+    cout << "Sum over [25, 75]: " << sums.rangeAggregate(25, 75) << endl;
+    cout << "Max over [10, 50]: " << maxes.rangeAggregate(10, 50) << endl;
+    cout << "Overwriting 50 and erasing 30" << endl;
+    sums.insert(std::make_pair(50, 100));
+    sums.remove(30);
+    cout << "Sum over [25, 75]: " << sums.rangeAggregate(25, 75) << endl;
+    cout << "Balanced: " << sums.isBalanced() << endl;
+
+    // Interval Tree Tests
+    IntervalTree<int,char> itree;
+    itree.insert(std::make_pair(Interval<int>(0, 10), 'a'));
+    itree.insert(std::make_pair(Interval<int>(5, 8), 'b'));
+    itree.insert(std::make_pair(Interval<int>(12, 20), 'c'));
+    itree.insert(std::make_pair(Interval<int>(15, 16), 'd'));
+    itree.insert(std::make_pair(Interval<int>(25, 30), 'e'));
+    itree.insert(std::make_pair(Interval<int>(5, 30), 'f'));
+
+    cout << "\nIntervals overlapping [9, 15):" << endl;
+    std::vector<IntervalTree<int,char>::iterator> hits = itree.overlapping(9, 15);
+    // The queries return hits in no particular order
+    auto byInterval = [](const IntervalTree<int,char>::iterator& a, const IntervalTree<int,char>::iterator& b) {
+        return a->first < b->first;
+    };
+    std::sort(hits.begin(), hits.end(), byInterval);
+    for(size_t i = 0; i < hits.size(); ++i) {
+        cout << hits[i]->first << " " << hits[i]->second << endl;
+    }
+    cout << "Erasing [5,30)" << endl;
+    itree.remove(Interval<int>(5, 30));
+    cout << "Intervals containing 15:" << endl;
+    hits = itree.stabbing(15);
+    std::sort(hits.begin(), hits.end(), byInterval);
+    for(size_t i = 0; i < hits.size(); ++i) {
+        cout << hits[i]->first << " " << hits[i]->second << endl;
+    }
+
+    // Multimap Tests
+    AVLTree<int,char> mm;
+    mm.setMultimap(true);
+    mm.insert(std::make_pair(2, 'a'));
+    mm.insert(std::make_pair(1, 'b'));
+    mm.insert(std::make_pair(2, 'c'));
+    mm.insert(mm.end(), std::make_pair(3, 'd'));
+    mm.insert(std::make_pair(2, 'e'));
+
+    cout << "\nMultimap contents:" << endl;
+    for(AVLTree<int,char>::iterator it = mm.begin(); it != mm.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "count(2) = " << mm.count(2) << endl;
+    std::pair<AVLTree<int,char>::iterator, AVLTree<int,char>::iterator> range = mm.equal_range(2);
+    cout << "Erasing the first 2" << endl;
+    AVLTree<int,char>::iterator next = mm.erase(range.first);
+    cout << "Next item: " << next->first << " " << next->second << endl;
+    cout << "Removing every 2" << endl;
+    mm.remove(2);
+    cout << "count(2) = " << mm.count(2) << ", balanced: " << mm.isBalanced() << endl;
+
+    // Lazy Removal Tests
+    AVLTree<int,int> lazy;
+    lazy.setCompactThreshold(0);
+    for(int i = 1; i <= 7; ++i) {
+        lazy.insert(std::make_pair(i, i * i));
+    }
+    cout << "\nLazily removing 2, 4 and 6" << endl;
+    lazy.lazyRemove(2);
+    lazy.lazyRemove(4);
+    lazy.lazyRemove(6);
+    for(AVLTree<int,int>::iterator it = lazy.begin(); it != lazy.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Tombstones: " << lazy.tombstoneCount() << endl;
+    if(lazy.find(4) == lazy.end()) {
+        cout << "Did not find 4" << endl;
+    }
+    cout << "Re-inserting 4" << endl;
+    lazy.insert(std::make_pair(4, 40));
+    cout << "lazy[4] = " << lazy[4] << ", tombstones: " << lazy.tombstoneCount() << endl;
+    lazy.compact();
+    cout << "After compact, tombstones: " << lazy.tombstoneCount() << ", balanced: " << lazy.isBalanced() << endl;
+    lazy.print();
+    SplayTree<int,int> lazySplay;
+    for(int i = 1; i <= 3; ++i) {
+        lazySplay.insert(std::make_pair(i, i));
+    }
+    lazySplay.lazyRemove(2);
+    lazySplay.remove(2);
+    cout << "SplayTree remove after lazyRemove: tombstones " << lazySplay.tombstoneCount()
+         << ", nodes " << lazySplay.memoryUsage().nodes << endl;
+    AVLTree<int,int> onlyTombstones;
+    onlyTombstones.setCompactThreshold(0);
+    onlyTombstones.insert(std::make_pair(1, 1));
+    onlyTombstones.lazyRemove(1);
+    cout << "Only tombstones: empty " << onlyTombstones.empty() << ", size " << onlyTombstones.size()
+         << ", begin == end " << (onlyTombstones.begin() == onlyTombstones.end()) << endl;
+
+    // Parallel Scan Tests
+    AVLTree<int,int> big;
+    for(int i = 1; i <= 1000; ++i) {
+        big.insert(std::make_pair(i, i));
+    }
+    WorkStealingPool pool(4);
+    long long total = big.parallelReduce(0LL,
+        [](const std::pair<const int,int>& item) { return (long long)item.second; },
+        [](long long a, long long b) { return a + b; }, true, pool);
+    cout << "\nParallel sum of 1..1000: " << total << endl;
+    std::string digits = big.parallelReduce(std::string(),
+        [](const std::pair<const int,int>& item) { return item.first <= 9 ? std::to_string(item.first) : std::string(); },
+        [](const std::string& a, const std::string& b) { return a + b; }, true, pool);
+    cout << "Ordered reduce of keys 1..9: " << digits << endl;
+    std::mutex countLock;
+    int visited = 0;
+    big.parallelForEach([&](const std::pair<const int,int>& item) {
+        std::lock_guard<std::mutex> guard(countLock);
+        ++visited;
+    }, false, pool);
+    cout << "parallelForEach visited " << visited << " items" << endl;
+    // Ordered calls come one at a time, so no lock
+    std::vector<int> seen;
+    big.parallelForEach([&](const std::pair<const int,int>& item) {
+        seen.push_back(item.first);
+    }, true, pool);
+    cout << "Ordered parallelForEach saw " << seen.size() << " items, "
+         << (std::is_sorted(seen.begin(), seen.end()) ? "in" : "NOT in") << " key order" << endl;
+
+    // Bulk Load Tests
+    std::vector<std::pair<int,char> > dump;
+    dump.push_back(std::make_pair(5, 'a'));
+    dump.push_back(std::make_pair(1, 'b'));
+    dump.push_back(std::make_pair(4, 'c'));
+    dump.push_back(std::make_pair(1, 'd'));
+    dump.push_back(std::make_pair(3, 'e'));
+    dump.push_back(std::make_pair(2, 'f'));
+    AVLTree<int,char> loaded;
+    loaded.buildParallel(dump.begin(), dump.end(), pool);
+    cout << "\nbuildParallel from an unsorted dump:" << endl;
+    for(AVLTree<int,char>::iterator it = loaded.begin(); it != loaded.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Balanced: " << loaded.isBalanced() << endl;
+
+    // Export/Import Tests
+    int keys[8];
+    char values[8];
+    size_t exported = loaded.exportKeys(keys, 8);
+    loaded.exportValues(values, 8);
+    cout << "\nExported " << exported << " keys:";
+    for(size_t i = 0; i < exported; ++i) {
+        cout << " " << keys[i] << values[i];
+    }
+    cout << endl;
+    cout << "Export capped at 2: " << loaded.exportKeys(keys, 2) << endl;
+
+    RedBlackTree<int,char> imported;
+    imported.importSorted(keys, values, exported);
+    cout << "importSorted size: " << imported.size() << " value at 4: " << imported[4] << endl;
+    keys[0] = 9;
+    try {
+        imported.importSorted(keys, values, exported);
+    }
+    catch(std::invalid_argument& e) {
+        cout << "Unsorted import rejected, size now " << imported.size() << endl;
+    }
+
+    // Merge Tests
+    AVLTree<int,char> base;
+    base.insert(std::make_pair(1, 'a'));
+    base.insert(std::make_pair(3, 'c'));
+    base.insert(std::make_pair(5, 'e'));
+    AVLTree<int,char> delta;
+    delta.insert(std::make_pair(2, 'B'));
+    delta.insert(std::make_pair(3, 'C'));
+    delta.insert(std::make_pair(6, 'F'));
+    base.merge(delta, MERGE_KEEP_LEFT);
+    cout << "\nMerged, keeping left on conflicts:" << endl;
+    for(AVLTree<int,char>::iterator it = base.begin(); it != base.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Delta empty: " << delta.empty() << " Balanced: " << base.isBalanced() << endl;
+
+    AVLTree<std::string,int> counts;
+    counts.insert(std::make_pair(std::string("apple"), 2));
+    counts.insert(std::make_pair(std::string("pear"), 1));
+    AVLTree<std::string,int> moreCounts;
+    moreCounts.insert(std::make_pair(std::string("apple"), 5));
+    moreCounts.insert(std::make_pair(std::string("fig"), 3));
+    counts.merge(moreCounts, [](const int& a, const int& b) { return a + b; });
+    cout << "Merged counts: apple " << counts["apple"] << " fig " << counts["fig"]
+         << " pear " << counts["pear"] << endl;
+
+    // Batch Tests
+    AVLTree<int,int> batched;
+    batched.beginBatch();
+    for(int i = 0; i < 64; ++i) {
+        batched.insert(std::make_pair(i, i * i));
+    }
+    batched.remove(10);
+    cout << "\nInside a batch: balanced " << batched.isBalanced() << ", 9 -> " << batched[9] << endl;
+    batched.endBatch();
+    cout << "After endBatch: balanced " << batched.isBalanced() << ", size " << batched.size() << endl;
+    batched.insert(std::make_pair(100, 0));
+    cout << "Insert after the batch keeps it balanced: " << batched.isBalanced() << endl;
+
+    // Shape Tests
+    AVLTree<int,int> shaped;
+    for(int i = 0; i < 7; ++i) {
+        shaped.insert(shaped.end(), std::make_pair(i, i));
+    }
+    TreeShape shape = shaped.shape();
+    cout << "\nShape of 7 appended keys: " << shape.nodes << " nodes, " << shape.leaves
+         << " leaves at depths " << shape.minLeafDepth << " to " << shape.maxLeafDepth << endl;
+    cout << "Equal paths: " << shaped.equalPaths(pool) << endl;
+    shaped.insert(std::make_pair(7, 7));
+    cout << "Equal paths after one more: " << shaped.equalPaths(pool) << ", parallel leaves "
+         << shaped.shape(pool).leaves << endl;
+
+    // Export Tests
+    cout << "\nJSON export:" << endl;
+    shaped.exportJson(cout);
+    ExportOptions shallow;
+    shallow.maxDepth = 1;
+    shallow.values = false;
+    cout << "DOT export, two levels:" << endl;
+    shaped.exportDot(cout, shallow);
+    RedBlackTree<int,std::string> colored;
+    colored.insert(std::make_pair(2, std::string("two")));
+    colored.insert(std::make_pair(1, std::string("one \"1\"")));
+    colored.insert(std::make_pair(3, std::string("three")));
+    cout << "JSON export of the subtree under 1:" << endl;
+    colored.exportJson(cout, 1);
+    BinarySearchTree<std::string,char> typed;
+    typed.insert(std::make_pair(std::string("42"), 'x'));
+    typed.insert(std::make_pair(std::string("true"), '7'));
+    cout << "JSON export keeps string keys and char values quoted:" << endl;
+    typed.exportJson(cout);
+
+    // Memory Tests
+    AVLTree<int,std::string> sized;
+    sized.insert(std::make_pair(1, std::string("one")));
+    sized.setValueSizer([](const int&, const std::string& value) -> size_t { return value.size(); });
+    sized.insert(std::make_pair(2, std::string("two")));
+    sized.insert(std::make_pair(1, std::string("eleven")));
+    MemoryUsage usage = sized.memoryUsage();
+    cout << "\nMemory: " << usage.nodes << " nodes, " << usage.valueBytes << " value bytes, "
+         << (usage.nodeBytes == 2 * sizeof(AVLNode<int,std::string>)) << endl;
+    sized.remove(2);
+    cout << "After remove: " << sized.memoryUsage().nodes << " nodes, " << sized.memoryUsage().valueBytes << " value bytes" << endl;
+    sized.clear();
+    cout << "After clear: " << sized.memoryUsage().nodes << " nodes, " << sized.memoryUsage().valueBytes << " value bytes" << endl;
+
+    // String Key Tests
+    AVLTree<std::string,int> urls;
+    const char* paths[] = { "/a", "/a/b", "/a/bc", "/abc", "", "/a/b/c/d/e/f/g/h/i", "/a/b/c/d/e/f/g/h/j", "/a/b/c" };
+    for(int i = 0; i < 8; ++i) {
+        urls.insert(std::make_pair("https://example.com" + std::string(paths[i]), i));
+    }
+    cout << "\nString keys: /a/b -> " << urls.find("https://example.com/a/b")->second
+         << ", /a/b/c/d/e/f/g/h/j -> " << urls.find("https://example.com/a/b/c/d/e/f/g/h/j")->second
+         << ", /a/b/c/d found " << (urls.find("https://example.com/a/b/c/d") != urls.end()) << endl;
+    cout << "Count of /a/b/c/d: " << urls.count("https://example.com/a/b/c/d")
+         << ", equal_range(/a/b/c) starts at " << urls.equal_range("https://example.com/a/b/c").first->second << endl;
+
+    // Relayout Tests
+    AVLTree<int,int> packed;
+    for(int i = 1; i <= 31; ++i) {
+        packed.insert(std::make_pair(i, i * 2));
+    }
+    packed.lazyRemove(5);
+    packed.relayout();
+    cout << "\nAfter relayout: size " << packed.size() << ", tombstones " << packed.tombstoneCount()
+         << ", balanced " << packed.isBalanced() << ", 17 -> " << packed[17] << endl;
+    packed.remove(17);
+    packed.insert(std::make_pair(40, 80));
+    packed.relayout(LAYOUT_BFS);
+    cout << "Relaid out level by level: first " << packed.begin()->first << ", size " << packed.size()
+         << ", balanced " << packed.isBalanced() << endl;
+
+    // Cursor Tests
+    AugmentedAVLTree<int,int> scanned;
+    for(int i = 1; i <= 10; ++i) {
+        scanned.insert(std::make_pair(i, i));
+    }
+    AugmentedAVLTree<int,int>::cursor cursor = scanned.cursorAt(scanned.begin());
+    while(cursor.valid()) {
+        if(cursor.key() % 3 == 0) {
+            cursor.erase();
+        }
+        else {
+            cursor.set(cursor.value() * 10);
+            ++cursor;
+        }
+    }
+    cout << "\nAfter the cursor scan:";
+    for(AugmentedAVLTree<int,int>::iterator it = scanned.begin(); it != scanned.end(); ++it) {
+        cout << " " << it->first << ":" << it->second;
+    }
+    cout << endl << "Sum " << scanned.aggregate() << ", balanced " << scanned.isBalanced() << endl;
+    AugmentedAVLTree<int,int>::iterator after = scanned.erase(scanned.find(2), scanned.find(8));
+    cout << "Erasing [2, 8) stops at " << after->first << ", size " << scanned.size() << endl;
+
+    // Upsert Tests
+    AugmentedAVLTree<std::string,int> words;
+    const char* text[] = { "the", "cat", "and", "the", "hat", "and", "the", "bat" };
+    for(int i = 0; i < 8; ++i) {
+        words.upsert(text[i], [](int& count) { count += 1; });
+    }
+    std::pair<AugmentedAVLTree<std::string,int>::iterator, bool> upserted =
+        words.upsert("cat", [](int& count) { count *= 10; }, []() { return -1; });
+    cout << "\nCounts: the " << words["the"] << ", and " << words["and"] << ", cat " << words["cat"]
+         << " (inserted " << upserted.second << "), total " << words.aggregate() << endl;
+    words.getOrInsert("dog") += 5;
+    cout << "getOrInsert: dog " << words.getOrInsert("dog") << ", the " << words.getOrInsert("the", 100)
+         << ", size " << words.size() << endl;
+
+    // Range Removal Tests
+    AVLTree<int,int> window;
+    for(int i = 1; i <= 40; ++i) {
+        window.insert(std::make_pair(i, i));
+    }
+    window.lazyRemove(12);
+    size_t expired = window.removeRange(5, 30);
+    cout << "\nremoveRange(5, 30) removed " << expired << ", left:";
+    for(AVLTree<int,int>::iterator it = window.begin(); it != window.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl << "Balanced " << window.isBalanced() << ", nodes " << window.memoryUsage().nodes
+         << ", empty range removes " << window.removeRange(10, 20) << endl;
+    RedBlackTree<int,int> rbWindow;
+    for(int i = 1; i <= 10; ++i) {
+        rbWindow.insert(std::make_pair(i, i));
+    }
+    cout << "Red-black removeRange(3, 7) removed " << rbWindow.removeRange(3, 7) << ", size " << rbWindow.size()
+         << ", valid red-black tree " << rbWindow.isValid() << endl;
+
+    // Latency Tests
+    AVLTree<int,int> timed;
+    timed.enableLatencyStats();
+    for(int i = 0; i < 100; ++i) {
+        timed.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 150; ++i) {
+        timed.find(i);
+    }
+    timed.remove(3);
+    timed.lazyRemove(4);
+    AVLTree<int,int>::cursor stepper = timed.cursorAt(timed.begin());
+    for(int i = 0; i < 10; ++i) {
+        ++stepper;
+    }
+    size_t stepped = 0;
+    for(AVLTree<int,int>::iterator it = timed.begin(); it != timed.end(); ++it) {
+        ++stepped;
+    }
+    SplayTree<int,int> timedSplay;
+    timedSplay.enableLatencyStats();
+    timedSplay.insert(std::make_pair(1, 1));
+    timedSplay.find(1);
+    LatencyStats latency = timed.latencyStats();
+    latency.merge(timedSplay.latencyStats());
+    cout << "\nLatency counts: find " << latency.ops[LATENCY_FIND].count() << ", insert " << latency.ops[LATENCY_INSERT].count()
+         << ", remove " << latency.ops[LATENCY_REMOVE].count() << ", step " << latency.ops[LATENCY_STEP].count() << " (10 cursor + " << stepped << " scan)" << endl;
+    const LatencyHistogram& finds = latency.ops[LATENCY_FIND];
+    cout << "Percentiles ordered " << (finds.min() <= finds.percentile(50) && finds.percentile(50) <= finds.percentile(99) &&
+                                       finds.percentile(99) <= finds.percentile(99.9) && finds.percentile(99.9) <= finds.max())
+         << ", 1000 ticks bucketed up to " << LatencyHistogram::bucketTop(LatencyHistogram::bucket(1000)) << endl;
+    AVLTree<int,int>::iterator held = timed.begin();
+    timed.disableLatencyStats();
+    timed.find(5);
+    ++held;
+    cout << "After disable: find count " << timed.latencyStats().ops[LATENCY_FIND].count()
+         << ", step count " << timed.latencyStats().ops[LATENCY_STEP].count() << endl;
+
+    // Journal Tests
+    std::remove("bst-test.log");
+    std::remove("bst-test.snap");
+    {
+        AVLTree<int,std::string> durable;
+        Journal<int,std::string> journal(durable, "bst-test.log", "bst-test.snap");
+        journal.insert(std::make_pair(1, std::string("one")));
+        journal.insert(std::make_pair(2, std::string("two")));
+        journal.checkpoint();
+        journal.insert(std::make_pair(3, std::string("three")));
+        journal.waitDurable(journal.remove(1));
+    }
+    {
+        AVLTree<int,std::string> recovered;
+        Journal<int,std::string> journal(recovered, "bst-test.log", "bst-test.snap");
+        cout << "\nRecovered after replaying " << journal.replayed() << " log records:" << endl;
+        for(AVLTree<int,std::string>::iterator it = recovered.begin(); it != recovered.end(); ++it) {
+            cout << it->first << " " << it->second << endl;
+        }
+    }
+    std::remove("bst-test.log");
+    std::remove("bst-test.snap");
+
     return 0;
 }
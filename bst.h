@@ -3,9 +3,111 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
 #include <utility>
 #include <cmath>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <typeinfo>
+#include <type_traits>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include "threadpool.h"
+#include "tree-shape.h"
+#include "tree-export.h"
+#include "latency.h"
+
+// Cache hint for the explicit-stack walks, a no-op where unsupported
+#if defined(__GNUC__)
+#define BST_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define BST_PREFETCH(address)
+#endif
+
+/**
+* Inline copy of a few key bytes, so a descent can often decide a
+* comparison without touching the key's heap buffer. Only std::string
+* keys have one (specialized below); for every other key type this is
+* an empty base and costs nothing.
+*/
+template <typename Key>
+class NodeKeyPrefix
+{
+public:
+    static const bool enabled = false;
+
+    explicit NodeKeyPrefix(const Key&) { }
+    void setKeyPrefix(const Key&, size_t) { }
+    size_t prefixOffset() const { return 0; }
+    static size_t commonPrefix(const Key&, const Key&) { return 0; }
+};
+
+/**
+* For std::string keys the node keeps up to 8 bytes of its key, starting
+* at offset. The tree sets offset to the common prefix length of the two
+* nearest ancestors on either side: every key in the node's subtree, and
+* every key a descent can be looking for once it gets there, starts with
+* that many bytes in common, so the stored bytes are the first ones a
+* comparison still has to look at.
+*/
+template <>
+class NodeKeyPrefix<std::string>
+{
+public:
+    static const bool enabled = true;
+    enum { PREFIX_BYTES = 8 };
+
+    explicit NodeKeyPrefix(const std::string& key) { setKeyPrefix(key, 0); }
+
+    void setKeyPrefix(const std::string& key, size_t offset)
+    {
+        offset = std::min(std::min(offset, key.size()), (size_t)UINT32_MAX);
+        prefixOffset_ = (uint32_t)offset;
+        prefixLength_ = (uint8_t)std::min((size_t)PREFIX_BYTES, key.size() - offset);
+        memcpy(prefix_, key.data() + offset, prefixLength_);
+    }
+
+    size_t prefixOffset() const { return prefixOffset_; }
+    // Fewer than PREFIX_BYTES means the key ends right after the prefix
+    size_t prefixLength() const { return prefixLength_; }
+    // Byte i of the key, for prefixOffset() <= i < prefixOffset() + prefixLength()
+    char prefixByte(size_t i) const { return prefix_[i - prefixOffset_]; }
+
+    static size_t commonPrefix(const std::string& a, const std::string& b)
+    {
+        return matchFrom(a.data(), b.data(), 0, std::min(a.size(), b.size()));
+    }
+
+    // First index in [i, end) where a and b differ, or end; eight bytes
+    // at a time where the first differing byte can be found from the XOR
+    static size_t matchFrom(const char* a, const char* b, size_t i, size_t end)
+    {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        for(; i + 8 <= end; i += 8){
+            uint64_t x;
+            uint64_t y;
+            memcpy(&x, a + i, 8);
+            memcpy(&y, b + i, 8);
+            if(x != y){
+                return i + __builtin_ctzll(x ^ y) / 8;
+            }
+        }
+#endif
+        while(i < end && a[i] == b[i]){
+            ++i;
+        }
+        return i;
+    }
+
+protected:
+    uint32_t prefixOffset_;
+    uint8_t prefixLength_;
+    char prefix_[PREFIX_BYTES];
+};
 
 /**
  * A templated class for a Node in a search tree.
@@ -15,7 +117,7 @@
  * and AVL trees.
  */
 template <typename Key, typename Value>
-class Node
+class Node : public NodeKeyPrefix<Key>
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
@@ -30,17 +132,25 @@ public:
     virtual Node<Key, Value>* getParent() const;
     virtual Node<Key, Value>* getLeft() const;
     virtual Node<Key, Value>* getRight() const;
+    // Non-virtual child access for descents: 0 is left, 1 is right
+    Node<Key, Value>* getChild(int side) const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
 
+    // Lazily removed nodes stay linked in but are skipped by lookups
+    // and iteration until the tree is compacted.
+    bool isTombstone() const;
+    void setTombstone(bool tombstone);
+
 protected:
     std::pair<const Key, Value> item_;
     Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    // left, right
+    Node<Key, Value>* children_[2];
+    bool tombstone_;
 };
 
 /*
@@ -55,12 +165,13 @@ protected:
 */
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+    NodeKeyPrefix<Key>(key),
     item_(key, value),
     parent_(parent),
-    left_(NULL),
-    right_(NULL)
+    tombstone_(false)
 {
-
+    children_[0] = NULL;
+    children_[1] = NULL;
 }
 
 /**
@@ -134,7 +245,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
 {
-    return left_;
+    return children_[0];
 }
 
 /**
@@ -143,7 +254,17 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
 {
-    return right_;
+    return children_[1];
+}
+
+/**
+* Either child without a virtual call, so a descent can index it with
+* the result of a comparison.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getChild(int side) const
+{
+    return children_[side];
 }
 
 /**
@@ -161,7 +282,7 @@ void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 template<typename Key, typename Value>
 void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 {
-    left_ = left;
+    children_[0] = left;
 }
 
 /**
@@ -170,7 +291,7 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 template<typename Key, typename Value>
 void Node<Key, Value>::setRight(Node<Key, Value>* right)
 {
-    right_ = right;
+    children_[1] = right;
 }
 
 /**
@@ -182,12 +303,419 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A getter for the tombstone flag.
+*/
+template<typename Key, typename Value>
+bool Node<Key, Value>::isTombstone() const
+{
+    return tombstone_;
+}
+
+/**
+* A setter for the tombstone flag.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setTombstone(bool tombstone)
+{
+    tombstone_ = tombstone;
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+/**
+* Hash used by the optional lookup cache. Keys without a std::hash
+* all map to slot 0, which turns the cache into a single
+* "last key looked up" entry.
+*/
+template<typename Key, typename Enable = void>
+struct LookupCacheHash
+{
+    size_t operator()(const Key&) const { return 0; }
+};
+
+template<typename Key>
+struct LookupCacheHash<Key, decltype(void(std::hash<Key>()(std::declval<const Key&>())))>
+{
+    size_t operator()(const Key& key) const { return std::hash<Key>()(key); }
+};
+
+/**
+* Key descents used by find(), insert() and the bound searches. The
+* generic version stops at the first equal key and branches on every
+* compare.
+*/
+template<typename Key>
+struct BranchingDescent
+{
+    template<typename Value>
+    static Node<Key, Value>* find(Node<Key, Value>* root, const Key& key)
+    {
+        Node<Key, Value>* current = root;
+        while(current != nullptr){
+            if(current->getKey() == key){
+                return current;
+            }
+            if(key < current->getKey()){
+                current = current->getLeft();
+            }
+            else{
+                current = current->getRight();
+            }
+        }
+        return nullptr;
+    }
+
+    // Where insert() goes: the node to overwrite (never in multimap mode,
+    // where equal keys go right), or nullptr with parent set to the node
+    // the new one hangs under. shared gets the prefix offset for the new
+    // node (see NodeKeyPrefix), 0 here.
+    template<typename Value>
+    static Node<Key, Value>* locate(Node<Key, Value>* root, const Key& key, bool multimap, Node<Key, Value>*& parent,
+                                    size_t& shared)
+    {
+        Node<Key, Value>* current = root;
+        parent = nullptr;
+        shared = 0;
+        while(current != nullptr){
+            if(key < current->getKey()){
+                parent = current;
+                current = current->getLeft();
+            }
+            else if(key > current->getKey() || multimap){
+                parent = current;
+                current = current->getRight();
+            }
+            else{
+                return current;
+            }
+        }
+        return nullptr;
+    }
+
+    // First node whose key is not less than key, or nullptr
+    template<typename Value>
+    static Node<Key, Value>* lowerBound(Node<Key, Value>* root, const Key& key)
+    {
+        Node<Key, Value>* current = root;
+        Node<Key, Value>* result = nullptr;
+        while(current != nullptr){
+            if(current->getKey() < key){
+                current = current->getRight();
+            }
+            else{
+                result = current;
+                current = current->getLeft();
+            }
+        }
+        return result;
+    }
+
+    // First node whose key is greater than key, or nullptr
+    template<typename Value>
+    static Node<Key, Value>* upperBound(Node<Key, Value>* root, const Key& key)
+    {
+        Node<Key, Value>* current = root;
+        Node<Key, Value>* result = nullptr;
+        while(current != nullptr){
+            if(key < current->getKey()){
+                result = current;
+                current = current->getLeft();
+            }
+            else{
+                current = current->getRight();
+            }
+        }
+        return result;
+    }
+};
+
+template<typename Key, typename Enable = void>
+struct KeyDescent : public BranchingDescent<Key>
+{
+};
+
+/**
+* Integer and floating-point keys compare cheaply, so their lookups
+* never stop early: every level does one compare, indexes the child
+* array with the result and keeps the candidate with a conditional move.
+* The only branch left is the loop test. find() is a lower bound plus
+* one equality check at the end (so in multimap mode it finds the first
+* of the equal keys).
+*/
+template<typename Key>
+struct KeyDescent<Key, typename std::enable_if<std::is_arithmetic<Key>::value>::type> : public BranchingDescent<Key>
+{
+    template<typename Value>
+    static Node<Key, Value>* find(Node<Key, Value>* root, const Key& key)
+    {
+        Node<Key, Value>* node = lowerBound(root, key);
+        return (node != nullptr && !(key < node->getKey())) ? node : nullptr;
+    }
+
+    // Always runs down to a leaf. Equal keys go right, so a match is the
+    // last node the descent went right from.
+    template<typename Value>
+    static Node<Key, Value>* locate(Node<Key, Value>* root, const Key& key, bool multimap, Node<Key, Value>*& parent,
+                                    size_t& shared)
+    {
+        Node<Key, Value>* current = root;
+        Node<Key, Value>* notGreater = nullptr;
+        parent = nullptr;
+        shared = 0;
+        while(current != nullptr){
+            BST_PREFETCH(current->getChild(0));
+            BST_PREFETCH(current->getChild(1));
+            parent = current;
+            bool right = !(key < current->getKey());
+            notGreater = right ? current : notGreater;
+            current = current->getChild(right);
+        }
+        if(!multimap && notGreater != nullptr && !(notGreater->getKey() < key)){
+            return notGreater;
+        }
+        return nullptr;
+    }
+
+    template<typename Value>
+    static Node<Key, Value>* lowerBound(Node<Key, Value>* root, const Key& key)
+    {
+        Node<Key, Value>* current = root;
+        Node<Key, Value>* result = nullptr;
+        while(current != nullptr){
+            BST_PREFETCH(current->getChild(0));
+            BST_PREFETCH(current->getChild(1));
+            bool right = current->getKey() < key;
+            result = right ? result : current;
+            current = current->getChild(right);
+        }
+        return result;
+    }
+
+    template<typename Value>
+    static Node<Key, Value>* upperBound(Node<Key, Value>* root, const Key& key)
+    {
+        Node<Key, Value>* current = root;
+        Node<Key, Value>* result = nullptr;
+        while(current != nullptr){
+            bool right = !(key < current->getKey());
+            result = right ? result : current;
+            current = current->getChild(right);
+        }
+        return result;
+    }
+};
+
+/**
+* std::string keys compare against the node's inline prefix first (see
+* NodeKeyPrefix) and only read the key itself when the prefix runs out
+* without a difference. Each descent tracks how many leading bytes key
+* shares with the nearest ancestors passed on either side; every node
+* below shares at least that many with key too, so comparisons start
+* there.
+*/
+template<>
+struct KeyDescent<std::string>
+{
+    // Compares key with node's key, given that their first matched bytes
+    // are equal. Leaves their exact common prefix length in matched.
+    template<typename Value>
+    static int compare(const std::string& key, const Node<std::string, Value>* node, size_t& matched)
+    {
+        size_t i = matched;
+        size_t offset = node->prefixOffset();
+        size_t length = node->prefixLength();
+        if(offset <= i && i <= offset + length){
+            size_t end = std::min(offset + length, key.size());
+            while(i < end && key[i] == node->prefixByte(i)){
+                ++i;
+            }
+            matched = i;
+            if(i < end){
+                return (unsigned char)key[i] < (unsigned char)node->prefixByte(i) ? -1 : 1;
+            }
+            // A short prefix holds the rest of the node's key
+            if(length < (size_t)NodeKeyPrefix<std::string>::PREFIX_BYTES && i == offset + length){
+                return i == key.size() ? 0 : 1;
+            }
+            if(i == key.size() && i < offset + length){
+                return -1;
+            }
+        }
+
+        const std::string& other = node->getKey();
+        size_t end = std::min(key.size(), other.size());
+        i = NodeKeyPrefix<std::string>::matchFrom(key.data(), other.data(), i, end);
+        matched = i;
+        if(i < end){
+            return (unsigned char)key[i] < (unsigned char)other[i] ? -1 : 1;
+        }
+        return key.size() < other.size() ? -1 : (key.size() > other.size() ? 1 : 0);
+    }
+
+    template<typename Value>
+    static Node<std::string, Value>* find(Node<std::string, Value>* root, const std::string& key)
+    {
+        size_t lowMatch = 0;
+        size_t highMatch = 0;
+        Node<std::string, Value>* current = root;
+        while(current != nullptr){
+            size_t matched = std::min(lowMatch, highMatch);
+            int order = compare(key, current, matched);
+            if(order == 0){
+                return current;
+            }
+            if(order < 0){
+                highMatch = matched;
+                current = current->getChild(0);
+            }
+            else{
+                lowMatch = matched;
+                current = current->getChild(1);
+            }
+        }
+        return nullptr;
+    }
+
+    // For sorted keys low < key < high, the common prefix of low and high
+    // is the smaller of key's with each, so the descent already knows the
+    // new node's prefix offset when it falls off the tree
+    template<typename Value>
+    static Node<std::string, Value>* locate(Node<std::string, Value>* root, const std::string& key, bool multimap,
+                                            Node<std::string, Value>*& parent, size_t& shared)
+    {
+        size_t lowMatch = 0;
+        size_t highMatch = 0;
+        Node<std::string, Value>* current = root;
+        parent = nullptr;
+        while(current != nullptr){
+            size_t matched = std::min(lowMatch, highMatch);
+            int order = compare(key, current, matched);
+            if(order == 0 && !multimap){
+                return current;
+            }
+            parent = current;
+            if(order < 0){
+                highMatch = matched;
+                current = current->getChild(0);
+            }
+            else{
+                lowMatch = matched;
+                current = current->getChild(1);
+            }
+        }
+        shared = std::min(lowMatch, highMatch);
+        return nullptr;
+    }
+
+    template<typename Value>
+    static Node<std::string, Value>* lowerBound(Node<std::string, Value>* root, const std::string& key)
+    {
+        size_t lowMatch = 0;
+        size_t highMatch = 0;
+        Node<std::string, Value>* current = root;
+        Node<std::string, Value>* result = nullptr;
+        while(current != nullptr){
+            size_t matched = std::min(lowMatch, highMatch);
+            if(compare(key, current, matched) <= 0){
+                result = current;
+                highMatch = matched;
+                current = current->getChild(0);
+            }
+            else{
+                lowMatch = matched;
+                current = current->getChild(1);
+            }
+        }
+        return result;
+    }
+
+    template<typename Value>
+    static Node<std::string, Value>* upperBound(Node<std::string, Value>* root, const std::string& key)
+    {
+        size_t lowMatch = 0;
+        size_t highMatch = 0;
+        Node<std::string, Value>* current = root;
+        Node<std::string, Value>* result = nullptr;
+        while(current != nullptr){
+            size_t matched = std::min(lowMatch, highMatch);
+            if(compare(key, current, matched) < 0){
+                result = current;
+                highMatch = matched;
+                current = current->getChild(0);
+            }
+            else{
+                lowMatch = matched;
+                current = current->getChild(1);
+            }
+        }
+        return result;
+    }
+};
+
+/**
+* Hit/miss counters for the lookup cache.
+*/
+struct LookupCacheStats
+{
+    size_t hits;
+    size_t misses;
+
+    double hitRate() const { return (hits + misses) == 0 ? 0.0 : (double)hits / (hits + misses); }
+};
+
+/**
+* What memoryUsage() reports. Everything is in bytes except nodes.
+*/
+struct MemoryUsage
+{
+    // Linked nodes, tombstones included
+    size_t nodes;
+    // nodes * sizeof(node), which includes the vtable pointer and padding
+    size_t nodeBytes;
+    // Allocator headers and rounding on top of nodeBytes, estimated for a
+    // malloc with one size_t header and 2 * sizeof(size_t) alignment (glibc).
+    // Nodes relayout() packed share one allocation instead; its freed
+    // slots count here until the whole block goes.
+    size_t slackBytes;
+    // Heap bytes the items own beyond their nodes, as reported by the
+    // value sizer (0 without one)
+    size_t valueBytes;
+    // The tree object itself plus its lookup cache
+    size_t treeBytes;
+
+    size_t total() const { return nodeBytes + slackBytes + valueBytes + treeBytes; }
+    double bytesPerNode() const { return nodes == 0 ? 0.0 : (double)total() / nodes; }
+};
+
+/**
+* Allocator overhead for one allocation of bytes, see MemoryUsage.
+*/
+inline size_t mallocSlack(size_t bytes)
+{
+    const size_t align = 2 * sizeof(size_t);
+    size_t chunk = (bytes + sizeof(size_t) + align - 1) & ~(align - 1);
+    return std::max(chunk, 2 * align) - bytes;
+}
+
+/**
+* Which value merge() keeps when both trees have the same key.
+*/
+enum MergePolicy { MERGE_KEEP_LEFT, MERGE_KEEP_RIGHT };
+
+/**
+* Node orders for relayout(). LAYOUT_VEB is the van Emde Boas order: the
+* top half of the levels first, then every subtree hanging below them,
+* each laid out the same way, so a root-to-leaf path crosses about
+* log(height) cache lines or pages whatever their size. LAYOUT_BFS goes
+* level by level, which packs the top levels tightest.
+*/
+enum NodeLayout { LAYOUT_VEB, LAYOUT_BFS };
+
 /**
 * A templated unbalanced binary search tree.
 */
@@ -227,6 +755,35 @@ public:
         friend class BinarySearchTree<Key, Value>;
         iterator(Node<Key,Value>* ptr);
         Node<Key, Value> *current_;
+        // The tree's latency histograms if it handed this iterator out
+        // with stats on; steps are timed while they stay enabled
+        std::vector<LatencyHistogram>* latency_;
+    };
+
+    /**
+    * A position for scans that change the tree as they go. set() stores
+    * a value the way insert() would, so augmented data and the value
+    * sizer see it; erase() removes the item with only the local fix-up
+    * and moves on to the next one. Changes made around the cursor other
+    * than through it may leave it dangling, just like an iterator.
+    */
+    class cursor
+    {
+    public:
+        // False once the cursor is past the last item
+        bool valid() const;
+        const Key& key() const;
+        const Value& value() const;
+        void set(const Value& value);
+        void erase();
+        cursor& operator++();
+        iterator position() const;
+
+    protected:
+        friend class BinarySearchTree<Key, Value>;
+        cursor(BinarySearchTree<Key, Value>* tree, iterator pos);
+        BinarySearchTree<Key, Value>* tree_;
+        iterator pos_;
     };
 
 public:
@@ -236,6 +793,138 @@ public:
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Read-modify-write in one descent. getOrInsert() is std::map's
+    // operator[]: key's value, with init inserted first if key isn't
+    // there (operator[] above throws instead). upsert() applies
+    // update(value) in place when key is there and inserts make()
+    // otherwise; without make it inserts a default Value with update
+    // applied. The bool says whether it inserted. Unlike writes through
+    // getOrInsert()'s reference, upsert()'s are seen by augmented data
+    // and the value sizer. In multimap mode both work on one of the
+    // items with key, as operator[] does.
+    Value& getOrInsert(const Key& key, const Value& init = Value());
+    template<typename Update>
+    std::pair<iterator, bool> upsert(const Key& key, Update update);
+    template<typename Update, typename Make>
+    std::pair<iterator, bool> upsert(const Key& key, Update update, Make make);
+
+    // Hinted versions: the search starts at hint (end() means the largest
+    // key) and only climbs as far as it has to.
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator find(iterator hint, const Key& key) const;
+
+    // Optional direct-mapped cache of recently found nodes, consulted by
+    // find() and operator[] before descending. Off by default.
+    void enableLookupCache(size_t slots);
+    void disableLookupCache();
+    LookupCacheStats lookupCacheStats() const;
+
+    // Optional latency histograms for find (including operator[]),
+    // insert, remove (including lazyRemove() and erase(pos)) and steps
+    // of cursors and of iterators from begin(), find() and equal_range().
+    // Off by default; like the lookup cache, const lookups write to
+    // them, so keep one tree (or stats copy) per thread and merge.
+    void enableLatencyStats();
+    void disableLatencyStats();
+    LatencyStats latencyStats() const;
+
+    // Multimap mode: insert() never overwrites, equal keys become separate
+    // nodes kept in insertion order, and remove(key) removes all of them.
+    // Off by default; pick the mode while the tree is empty.
+    void setMultimap(bool multimap);
+    bool isMultimap() const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    size_t count(const Key& key) const;
+    // Removes the item at pos and returns an iterator to the next one.
+    // No search: only the tree's own fix-up work runs.
+    iterator erase(iterator pos);
+    // Removes [first, last) and returns last
+    iterator erase(iterator first, iterator last);
+    // A cursor for changing the tree in the middle of a scan, at pos
+    cursor cursorAt(iterator pos);
+    // Removes every item with lo <= key <= hi and returns how many went.
+    // One erase() per item here; the AVL tree cuts the range out whole.
+    virtual size_t removeRange(const Key& lo, const Key& hi);
+
+    // Lazy removal: lazyRemove() only marks the key's node as a tombstone,
+    // without any rotations. Tombstones are invisible to lookups and
+    // iteration. compact() frees them and rebuilds the tree in one O(n)
+    // pass; it also runs by itself once tombstones make up more than
+    // the compact threshold (a fraction of all nodes, 0 turns that off).
+    void lazyRemove(const Key& key);
+    void compact();
+    void setCompactThreshold(double fraction);
+    size_t tombstoneCount() const;
+    // Copies every node into one contiguous block in the given order and
+    // frees the old ones, so lookups stop chasing pointers all over the
+    // heap after a lot of churn. Tombstones are dropped first, as by
+    // compact(); otherwise the shape and balance data stay as they are.
+    // O(n), and unlike compact() it invalidates every iterator.
+    void relayout(NodeLayout layout = LAYOUT_VEB);
+
+    // Parallel scans. The tree is cut into subtrees near the root and the
+    // pieces run on a work-stealing pool; nothing may modify the tree
+    // meanwhile. parallelForEach() calls copies of fn from several threads
+    // at once, in key order within each piece. With ordered, fn sees every
+    // item in key order, one call at a time: pieces are walked in parallel
+    // and buffered until the ones before them have been handed to fn, so
+    // only the walk runs in parallel. parallelReduce() folds map(item)
+    // with combine, starting every piece from init, so init has to be
+    // combine's identity. ordered combines the pieces in key order, which
+    // gives exactly the sequential result for any associative combine;
+    // without it pieces are combined as they finish (combine must then
+    // also be commutative).
+    template<typename Fn>
+    void parallelForEach(Fn fn, bool ordered = false,
+                         WorkStealingPool& pool = WorkStealingPool::shared()) const;
+    template<typename T, typename Map, typename Combine>
+    T parallelReduce(T init, Map map, Combine combine, bool ordered = true,
+                     WorkStealingPool& pool = WorkStealingPool::shared()) const;
+    // Bulk load from unsorted (key, value) pairs, replacing the contents
+    template<typename InputIt>
+    void buildParallel(InputIt first, InputIt last, WorkStealingPool& pool = WorkStealingPool::shared());
+
+    // Number of items (tombstones don't count)
+    size_t size() const;
+    // Bulk copies to and from plain arrays, in key order. The exports
+    // write at most capacity items and return how many they wrote.
+    size_t exportKeys(Key* out, size_t capacity) const;
+    size_t exportValues(Value* out, size_t capacity) const;
+    size_t exportItems(std::pair<Key, Value>* out, size_t capacity) const;
+    void importSorted(const std::pair<Key, Value>* items, size_t count);
+    void importSorted(const Key* keys, const Value* values, size_t count);
+
+    // Moves everything in other into this tree (other ends up empty) and
+    // rebalances, in O(m + n). For a key in both trees the policy picks
+    // this tree's value (left) or other's (right); the second form stores
+    // combine(left, right) instead. Multimap trees keep both items.
+    void merge(BinarySearchTree& other, MergePolicy policy = MERGE_KEEP_RIGHT);
+    template<typename Combine>
+    void merge(BinarySearchTree& other, Combine combine);
+
+    // Node count and leaf depth histogram (tombstones count, they are
+    // still nodes), optionally measured on a pool
+    TreeShape shape() const;
+    TreeShape shape(WorkStealingPool& pool) const;
+    // Whether every leaf is at the same depth, checked on a pool
+    bool equalPaths(WorkStealingPool& pool = WorkStealingPool::shared()) const;
+
+    // Memory accounting in O(1): the counts are kept up to date by every
+    // insert and remove. The value sizer reports the heap bytes an item
+    // owns outside its node (a string's buffer, say); setting one walks
+    // the tree once. Values changed through operator[] or an iterator
+    // are not seen by it, use insert() to overwrite them.
+    MemoryUsage memoryUsage() const;
+    void setValueSizer(std::function<size_t(const Key&, const Value&)> sizer);
+
+    // Streaming Graphviz DOT / JSON dumps of the whole tree, or of the
+    // subtree under top (std::out_of_range if top isn't in the tree).
+    // Keys and values are written with operator<<.
+    void exportDot(std::ostream& os, const ExportOptions& options = ExportOptions()) const;
+    void exportDot(std::ostream& os, const Key& top, const ExportOptions& options = ExportOptions()) const;
+    void exportJson(std::ostream& os, const ExportOptions& options = ExportOptions()) const;
+    void exportJson(std::ostream& os, const Key& top, const ExportOptions& options = ExportOptions()) const;
+
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const;
@@ -251,11 +940,120 @@ protected:
     // Add helper functions here
     bool balanceHelper(Node<Key, Value>* node) const;
     int findHeight(Node<Key, Value>* node) const;
+    void rotateLeft(Node<Key, Value>* current);
+    void rotateRight(Node<Key, Value>* current);
+    static iterator iteratorAt(Node<Key, Value>* node);
+    // it, set up to time its steps if latency stats are on
+    iterator withStepLatency(iterator it) const;
+    Node<Key, Value>* getLargestNode() const;
+    Node<Key, Value>* fingerStart(Node<Key, Value>* start, const Key& key) const;
+    Node<Key, Value>* lowerBound(const Key& key) const;
+    Node<Key, Value>* upperBound(const Key& key) const;
+    // Unlinks and frees one node; every kind of tree has its own fix-up
+    virtual void removeNode(Node<Key, Value>* node);
+    // compact() and buildParallel() call this for each node of the tree
+    // they build, parents first (possibly from several threads at once),
+    // so subclasses can reset balance data. depth is 0 at the root.
+    virtual void relinkNode(Node<Key, Value>* node, size_t leftSize, size_t rightSize, int depth);
+    iterator firstLive(Node<Key, Value>* node) const;
+    // Unlinks every node under top: the live ones are appended to live in
+    // key order and the tombstones are freed. Whatever pointed at top is
+    // left dangling for the caller.
+    void takeNodes(Node<Key, Value>* top, std::vector<Node<Key, Value>*>& live);
+    // Rebuilds the subtree under top as a perfectly balanced one in
+    // place, and returns its new top (nullptr if only tombstones were in it)
+    Node<Key, Value>* rebuildSubtree(Node<Key, Value>* top);
+    // Balanced (re)linking shared by compact() and buildParallel()
+    struct BuildRange {
+        size_t lo, hi;
+        Node<Key, Value>* parent;
+        bool isLeft;
+        int depth;
+    };
+    void linkBalanced(std::vector<Node<Key, Value>*>& nodes, WorkStealingPool* pool);
+    void buildRange(std::vector<Node<Key, Value>*>& nodes, const BuildRange& start, int cutDepth,
+                    std::vector<BuildRange>& pending, std::vector<Node<Key, Value>*>& order);
+    // Pieces for the parallel scans, in key order: (subtree root, true)
+    // for a whole subtree or (node, false) for just that node
+    void splitForParallel(size_t pieces, std::vector<std::pair<Node<Key, Value>*, bool> >& chunks) const;
+    template<typename Fn>
+    static void forEachInChunk(const std::pair<Node<Key, Value>*, bool>& chunk, Fn& fn);
+    template<typename Fn>
+    static size_t walkInOrder(Node<Key, Value>* root, size_t limit, Fn& fn);
+    template<typename T, typename GetKey, typename GetValue>
+    void importSortedItems(const T* items, size_t count, GetKey getKey, GetValue getValue);
+    void adoptNodes(std::vector<Node<Key, Value>*>& nodes, WorkStealingPool* pool);
+    // The tree's nodes in the order relayout() places them
+    void layoutOrder(NodeLayout layout, std::vector<Node<Key, Value>*>& order) const;
+    void overwriteNode(Node<Key, Value>* node, const Value& value);
+
+    // Every kind of tree creates, links and frees its nodes through these,
+    // so bookkeeping that lives in BinarySearchTree stays in one place.
+    Node<Key, Value>* attachNode(Node<Key, Value>* parent, const std::pair<const Key, Value>& keyValuePair,
+                                 size_t prefixOffset = SIZE_MAX);
+    void destroyNode(Node<Key, Value>* node);
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    // Copy-constructs node, which createNode() made, at where
+    virtual Node<Key, Value>* relocateNode(const Node<Key, Value>* node, void* where) const;
+    // Releases a node's memory, whether it came from new or sits in nodeBlock_
+    void freeNode(Node<Key, Value>* node);
+    virtual void rebalanceInsert(Node<Key, Value>* node);
+    // Augmented trees recompute per-subtree data here; both are no-ops
+    // for a plain BST. refreshNode() runs on the two nodes of every
+    // rotation, refreshPath() from a changed node up to the root.
+    virtual void refreshNode(Node<Key, Value>* node);
+    virtual void refreshPath(Node<Key, Value>* node);
+    // Called when getOrInsert() or upsert() finds node already there;
+    // a no-op except in the splay tree
+    virtual void accessNode(Node<Key, Value>* node);
+    // getOrInsert() and upsert()'s descent: the live node with key, or a
+    // new one holding make() (inserted says which)
+    template<typename Make>
+    Node<Key, Value>* findOrAttach(const Key& key, Make make, bool& inserted);
+    size_t lookupCacheSlot(const Key& key) const;
+    // The histogram for op, nullptr while latency stats are off
+    LatencyHistogram* latencyFor(LatencyOp op) const;
+    // Points node's inline key prefix (std::string keys only) at the
+    // bytes a descent still has to compare when it gets there. Called
+    // whenever a node takes a new place in the tree.
+    void refreshKeyPrefix(Node<Key, Value>* node);
+    // The same after a rotation lifted up over current, without the
+    // walk: outer is current's child on the side away from up
+    void rotateKeyPrefix(Node<Key, Value>* current, Node<Key, Value>* up, Node<Key, Value>* outer,
+                         size_t currentOffset);
+    // sizeof the node type createNode() makes
+    virtual size_t nodeSize() const;
+    size_t deepSize(const Node<Key, Value>* node) const;
+    // Annotations the exporters write after the key and value; the base
+    // version marks tombstones, subclasses add their balance data
+    virtual void describeNode(const Node<Key, Value>* node, ExportFields& fields) const;
+    Node<Key, Value>* exportTop(const Key& top) const;
+    void exportTree(std::ostream& os, const Node<Key, Value>* top, const ExportOptions& options, bool dot) const;
 
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // Cached largest node so appends don't have to walk the right spine.
+    // nullptr means "not known", getLargestNode() recomputes it.
+    mutable Node<Key, Value>* rightmost_;
+    // Lookup cache (empty when disabled). The size is a power of two.
+    mutable std::vector<Node<Key, Value>*> lookupCache_;
+    mutable LookupCacheStats lookupCacheStats_;
+    // One histogram per LatencyOp (empty when disabled)
+    mutable std::vector<LatencyHistogram> latencyHistograms_;
+    bool multimap_;
+    // Linked nodes (tombstones included) and how many are tombstones
+    size_t nodeCount_;
+    size_t tombstoneCount_;
+    double compactThreshold_;
+    std::function<size_t(const Key&, const Value&)> valueSizer_;
+    // Sum of valueSizer_ over every linked node
+    size_t valueBytes_;
+    // Block relayout() copied the nodes into, nullptr when there is none.
+    // It is freed once none of its nodes are left.
+    char* nodeBlock_;
+    size_t nodeBlockBytes_;
+    size_t nodeBlockLive_;
 };
 
 /*
@@ -271,6 +1069,7 @@ template<class Key, class Value>
 BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
 {
     current_ = ptr;
+    latency_ = nullptr;
 }
 
 /**
@@ -280,6 +1079,7 @@ template<class Key, class Value>
 BinarySearchTree<Key, Value>::iterator::iterator() 
 {
     current_ = nullptr;
+    latency_ = nullptr;
 
 }
 
@@ -336,24 +1136,27 @@ template<class Key, class Value>
 typename BinarySearchTree<Key, Value>::iterator&
 BinarySearchTree<Key, Value>::iterator::operator++()
 {
-    
-    // 1st case: Node has a right child -> go to leftmost child of right subtree
-    if(current_->getRight() != nullptr){
-      current_ = current_->getRight();
-      while(current_->getLeft() != nullptr){
-        current_ = current_->getLeft();
+    LatencyTimer timer(latency_ != nullptr && !latency_->empty() ? &(*latency_)[LATENCY_STEP] : nullptr);
+    // Repeat the step to skip over tombstones
+    do{
+      // 1st case: Node has a right child -> go to leftmost child of right subtree
+      if(current_->getRight() != nullptr){
+        current_ = current_->getRight();
+        while(current_->getLeft() != nullptr){
+          current_ = current_->getLeft();
+        }
       }
-    }
 
-    // 2nd case: Node doesn't have a right child -> move to parent node
-    else{
-      Node<Key, Value>* parent = current_->getParent();
-      while(parent != nullptr && current_ == parent->getRight()){
+      // 2nd case: Node doesn't have a right child -> move to parent node
+      else{
+        Node<Key, Value>* parent = current_->getParent();
+        while(parent != nullptr && current_ == parent->getRight()){
+          current_ = parent;
+          parent = parent->getParent();
+        }
         current_ = parent;
-        parent = parent->getParent();
       }
-      current_ = parent;
-    }
+    } while(current_ != nullptr && current_->isTombstone());
 
     return *this;
 }
@@ -365,6 +1168,77 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+-----------------------------------------------------------
+Begin implementations for the BinarySearchTree::cursor class.
+-----------------------------------------------------------
+*/
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::cursor::cursor(BinarySearchTree<Key, Value>* tree, iterator pos) :
+    tree_(tree), pos_(pos)
+{
+
+}
+
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::cursor::valid() const
+{
+    return pos_.current_ != nullptr;
+}
+
+template<class Key, class Value>
+const Key& BinarySearchTree<Key, Value>::cursor::key() const
+{
+    return pos_.current_->getKey();
+}
+
+template<class Key, class Value>
+const Value& BinarySearchTree<Key, Value>::cursor::value() const
+{
+    return pos_.current_->getValue();
+}
+
+/**
+* Same as insert() overwriting the item, without the search.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::cursor::set(const Value& value)
+{
+    tree_->overwriteNode(pos_.current_, value);
+    tree_->refreshPath(pos_.current_);
+}
+
+/**
+* Removes the item under the cursor and moves on to the next one.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::cursor::erase()
+{
+    pos_ = tree_->erase(pos_);
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::cursor&
+BinarySearchTree<Key, Value>::cursor::operator++()
+{
+    ++pos_;
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::cursor::position() const
+{
+    return pos_;
+}
+
+/*
+---------------------------------------------------------
+End implementations for the BinarySearchTree::cursor class.
+---------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -378,6 +1252,17 @@ template<class Key, class Value>
 BinarySearchTree<Key, Value>::BinarySearchTree() 
 {
     root_ = nullptr;
+    rightmost_ = nullptr;
+    lookupCacheStats_.hits = 0;
+    lookupCacheStats_.misses = 0;
+    multimap_ = false;
+    nodeCount_ = 0;
+    tombstoneCount_ = 0;
+    compactThreshold_ = 0.5;
+    valueBytes_ = 0;
+    nodeBlock_ = nullptr;
+    nodeBlockBytes_ = 0;
+    nodeBlockLive_ = 0;
 }
 
 template<typename Key, typename Value>
@@ -388,12 +1273,12 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 }
 
 /**
- * Returns true if tree is empty
+ * Returns true if tree is empty (tombstones don't count as items)
 */
 template<class Key, class Value>
 bool BinarySearchTree<Key, Value>::empty() const
 {
-    return root_ == NULL;
+    return size() == 0;
 }
 
 template<typename Key, typename Value>
@@ -410,8 +1295,7 @@ template<class Key, class Value>
 typename BinarySearchTree<Key, Value>::iterator
 BinarySearchTree<Key, Value>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return firstLive(getSmallestNode());
 }
 
 /**
@@ -433,9 +1317,10 @@ template<class Key, class Value>
 typename BinarySearchTree<Key, Value>::iterator
 BinarySearchTree<Key, Value>::find(const Key & k) const
 {
+    LatencyTimer timer(latencyFor(LATENCY_FIND));
     Node<Key, Value> *curr = internalFind(k);
     BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    return withStepLatency(it);
 }
 
 /**
@@ -445,6 +1330,7 @@ BinarySearchTree<Key, Value>::find(const Key & k) const
 template<class Key, class Value>
 Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
 {
+    LatencyTimer timer(latencyFor(LATENCY_FIND));
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
@@ -452,11 +1338,89 @@ Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
 template<class Key, class Value>
 Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 {
+    LatencyTimer timer(latencyFor(LATENCY_FIND));
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
 
+template<class Key, class Value>
+Value& BinarySearchTree<Key, Value>::getOrInsert(const Key& key, const Value& init)
+{
+    bool inserted = false;
+    return findOrAttach(key, [&]() -> const Value& { return init; }, inserted)->getValue();
+}
+
+template<class Key, class Value>
+template<typename Update>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::upsert(const Key& key, Update update)
+{
+    return upsert(key, update, [&]() -> Value {
+        Value value = Value();
+        update(value);
+        return value;
+    });
+}
+
+/**
+* Same bookkeeping as insert() overwriting the value, but update works
+* on the stored value instead of a copy.
+*/
+template<class Key, class Value>
+template<typename Update, typename Make>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::upsert(const Key& key, Update update, Make make)
+{
+    bool inserted = false;
+    Node<Key, Value>* node = findOrAttach(key, make, inserted);
+    if(!inserted){
+        valueBytes_ -= deepSize(node);
+        update(node->getValue());
+        valueBytes_ += deepSize(node);
+        refreshPath(node);
+    }
+    return std::make_pair(iterator(node), inserted);
+}
+
+/**
+* Finger search: like find(key), but starts at hint instead of the root.
+* The cost depends on how far key is from the hint rather than on the
+* size of the tree. Passing end() starts from the largest key.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::find(iterator hint, const Key& key) const
+{
+  Node<Key, Value>* start = hint.current_;
+  if(start == nullptr){
+    start = getLargestNode();
+    // Past the largest key (or empty tree) -> nothing to find
+    if(start == nullptr || key > start->getKey()){
+      return end();
+    }
+  }
+
+  Node<Key, Value>* current = fingerStart(start, key);
+  while(current != nullptr){
+    if(key < current->getKey()){
+      current = current->getLeft();
+    }
+    else if(key > current->getKey()){
+      current = current->getRight();
+    }
+    else{
+      break;
+    }
+  }
+
+  // Hit a tombstone: in multimap mode a live copy may still be elsewhere
+  if(current != nullptr && current->isTombstone()){
+    current = multimap_ ? internalFind(key) : nullptr;
+  }
+  return withStepLatency(iterator(current));
+}
+
 /**
 * An insert method to insert into a Binary Search Tree.
 * The tree will not remain balanced when inserting.
@@ -466,46 +1430,76 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 template<class Key, class Value>
 void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
+  LatencyTimer timer(latencyFor(LATENCY_INSERT));
   // Check to see if its bigger or smaller than the root
   // Keep going until you can't go any further 
-  // Dont have to do rotations
-  
-  // Base case: empty tree
-  if(root_ == nullptr){
-    // Create new node and set it as the root
-    root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
+  // Subclasses do their rotations in rebalanceInsert()
+
+  // Now we need to traverse the tree, checking how keyValuePair's key compares to each node's key
+  // (in multimap mode equal keys go right, after the existing ones)
+  Node<Key, Value>* parent = nullptr;
+  size_t shared = 0;
+  Node<Key, Value>* current = KeyDescent<Key>::locate(root_, keyValuePair.first, multimap_, parent, shared);
+
+  // Case where the inserted node is the same as current node -> overwrite value
+  if(current != nullptr){
+    overwriteNode(current, keyValuePair.second);
+    refreshPath(current);
     return;
   }
 
-  // Now we need to traverse the tree, checking how keyValuePair's key compares to each node's key
-  Node<Key, Value>* current = root_;
+  // Now we have reached the spot where we can insert the new node
+  // (parent is nullptr for an empty tree)
+  attachNode(parent, keyValuePair, shared);
+}
+
+/**
+* Hinted insert. Same overwrite semantics as insert(), but the search for
+* the insertion point starts at hint. Appending past the largest key with
+* hint == end() skips the descent entirely (in multimap mode that includes
+* appending another copy of the largest key).
+* Returns an iterator to the inserted (or updated) item.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+  LatencyTimer timer(latencyFor(LATENCY_INSERT));
+  Node<Key, Value>* start = hint.current_;
+  if(start == nullptr){
+    start = getLargestNode();
+  }
+
+  // Empty tree
+  if(start == nullptr){
+    return iterator(attachNode(nullptr, keyValuePair));
+  }
+
+  // Appending past the largest key: the new node is its right child
+  if(start == getLargestNode() && (keyValuePair.first > start->getKey() ||
+                                   (multimap_ && !(keyValuePair.first < start->getKey())))){
+    return iterator(attachNode(start, keyValuePair));
+  }
+
+  Node<Key, Value>* current = fingerStart(start, keyValuePair.first);
   Node<Key, Value>* parent = nullptr;
 
   while(current != nullptr){
-    // Case where the inserted node is less than current node -> move left
-    if(keyValuePair.first < current->getItem().first){
-      parent = current;
+    parent = current;
+    if(keyValuePair.first < current->getKey()){
       current = current->getLeft();
     }
-    // Case where the inserted node is greater than current node -> move right
-    else if(keyValuePair.first > current->getItem().first){
-      parent = current;
+    else if(keyValuePair.first > current->getKey() || multimap_){
       current = current->getRight();
     }
-    // Case where the inserted node is the same as current node -> overwrite value
     else{
-      current->setValue(keyValuePair.second);
-      return;
+      overwriteNode(current, keyValuePair.second);
+      refreshPath(current);
+      return iterator(current);
     }
   }
 
-  // Now we have reached the spot where we can insert the new node
-  if(keyValuePair.first < parent->getItem().first){
-    parent->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-  }
-  else if(keyValuePair.first > parent->getItem().first){
-    parent->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-  }
+  return iterator(attachNode(parent, keyValuePair));
 }
 
 
@@ -517,26 +1511,38 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::remove(const Key& key)
 {
-    
-  // Have to find where it is first
-  Node<Key, Value>* current = root_;
-
-  while(current != nullptr && current->getKey() != key){
-    // parent = current; // Moving down the tree
-    if(key < current->getKey()){
-      current = current->getLeft();
+  LatencyTimer timer(latencyFor(LATENCY_REMOVE));
+  // Have to find where it is first. In multimap mode keep going until
+  // every copy of the key is gone.
+  while(true){
+    Node<Key, Value>* current = root_;
+    while(current != nullptr && current->getKey() != key){
+      if(key < current->getKey()){
+        current = current->getLeft();
+      }
+      else{
+        current = current->getRight();
+      }
     }
-    else{
-      current = current->getRight();
+
+    // Case where the key wasn't found (or no copies are left)
+    if(current == nullptr){
+      return;
     }
-  }
 
-  // Case where the key wasn't found
-  if(current == nullptr){
-    return;
+    removeNode(current);
+    if(!multimap_){
+      return;
+    }
   }
+}
 
-  // Now that we've found the node to remove, we need to actually remove it
+/**
+* Removes a node that is known to be in the tree.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::removeNode(Node<Key, Value>* current)
+{
 
   // Case 1: Has no children
   if(current->getLeft() == nullptr && current->getRight() == nullptr){
@@ -552,7 +1558,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
       current->getParent()->setRight(nullptr);
     }
 
-    delete current;
+    destroyNode(current);
   }
 
   // Case 2: Only one child
@@ -580,7 +1586,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
       child->setParent(current->getParent());
     }
 
-    delete current;
+    destroyNode(current);
     current = nullptr;
   }
 
@@ -621,172 +1627,1792 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
       root_ = child;
     }
 
-    delete nodeToDelete;
+    destroyNode(nodeToDelete);
   } 
 }
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+/**
+* Marks the key's node as a tombstone (every copy of it in multimap
+* mode). The tree keeps its shape, so there are no rotations here.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::lazyRemove(const Key& key)
 {
-  // 1st case: Current node has left child
-  if(current->getLeft() != nullptr){
-    Node<Key, Value>* temp = current->getLeft();
-    while(temp->getRight() != nullptr){
-      temp = temp->getRight();
+  LatencyTimer timer(latencyFor(LATENCY_REMOVE));
+  Node<Key, Value>* current = internalFind(key);
+  while(current != nullptr){
+    current->setTombstone(true);
+    ++tombstoneCount_;
+    // The cache only ever holds live nodes
+    if(!lookupCache_.empty()){
+      Node<Key, Value>*& cached = lookupCache_[lookupCacheSlot(key)];
+      if(cached == current){
+        cached = nullptr;
+      }
+    }
+    refreshPath(current);
+    if(!multimap_){
+      break;
     }
+    current = internalFind(key);
+  }
 
-    return temp;
+  if(compactThreshold_ > 0 && tombstoneCount_ > compactThreshold_ * nodeCount_){
+    compact();
   }
+}
 
-  // 2nd case: Current node doesn't have a left child
-  else{
-    Node<Key, Value>* parent = current->getParent();
-    while(parent != nullptr && current == parent->getLeft()){
-      current = parent;
-      parent = parent->getParent();
-    }
+/**
+* Frees every tombstone and relinks the live nodes into a perfectly
+* balanced tree, in O(n) time. Live nodes are reused, so iterators to
+* them (and the lookup cache) stay valid.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::compact()
+{
+  if(tombstoneCount_ == 0){
+    return;
+  }
 
-    return parent;
+  std::vector<Node<Key, Value>*> live;
+  takeNodes(root_, live);
+  linkBalanced(live, nullptr);
+  rightmost_ = live.empty() ? nullptr : live.back();
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::takeNodes(Node<Key, Value>* top, std::vector<Node<Key, Value>*>& live)
+{
+  // In-order walk with an explicit stack
+  if(top == root_){
+    live.reserve(live.size() + nodeCount_ - tombstoneCount_);
+  }
+  std::vector<Node<Key, Value>*> stack;
+  Node<Key, Value>* current = top;
+  while(current != nullptr || !stack.empty()){
+    while(current != nullptr){
+      stack.push_back(current);
+      current = current->getLeft();
+    }
+    current = stack.back();
+    stack.pop_back();
+    Node<Key, Value>* right = current->getRight();
+    if(current->isTombstone()){
+      destroyNode(current);
+    }
+    else{
+      live.push_back(current);
+    }
+    current = right;
   }
 }
 
+/**
+* Like compact(), but for one subtree. relinkNode() sees depths counted
+* from top, so this is only meant for trees whose balance data depends on
+* subtree sizes alone.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::rebuildSubtree(Node<Key, Value>* top)
+{
+  Node<Key, Value>* parent = top->getParent();
+  bool isLeft = parent != nullptr && parent->getLeft() == top;
+  std::vector<Node<Key, Value>*> live;
+  takeNodes(top, live);
+
+  if(live.empty()){
+    if(parent == nullptr){
+      root_ = nullptr;
+    }
+    else if(isLeft){
+      parent->setLeft(nullptr);
+    }
+    else{
+      parent->setRight(nullptr);
+    }
+    return nullptr;
+  }
+
+  BuildRange range = { 0, live.size(), parent, isLeft, 0 };
+  std::vector<BuildRange> none;
+  std::vector<Node<Key, Value>*> order;
+  buildRange(live, range, -1, none, order);
+  return order.front();
+}
 
 /**
-* A method to remove all contents of the tree and
-* reset the values in the tree for use again.
+* Links nodes (sorted, already counted in nodeCount_) into a perfectly
+* balanced tree, replacing whatever root_ pointed to. Every range's
+* middle node is linked under its parent before the two halves are
+* pushed, so parents are always done first. With a pool, the ranges
+* that reach a few levels down are built as separate tasks.
 */
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+void BinarySearchTree<Key, Value>::linkBalanced(std::vector<Node<Key, Value>*>& nodes, WorkStealingPool* pool)
 {
-  // Straightforward
-  // Hint: you can just keep removing the root until you have nothing
-  while(root_ != nullptr){
+  root_ = nullptr;
+  if(nodes.empty()){
+    return;
+  }
 
-    // If left child isnt nullptr, we'll make it the root
-    if(root_->getLeft() != nullptr){
-      root_ = root_->getLeft();
+  // Sequentially the whole tree is one range; with a pool, stop at the
+  // depth that gives about 8 subtrees per worker
+  int cutDepth = -1;
+  if(pool != nullptr){
+    cutDepth = 0;
+    for(size_t n = 1; n < pool->size() * 8; n *= 2){
+      ++cutDepth;
     }
+  }
+
+  BuildRange all = { 0, nodes.size(), nullptr, false, 0 };
+  std::vector<BuildRange> pending;
+  std::vector<Node<Key, Value>*> top;
+  buildRange(nodes, all, cutDepth, pending, top);
+
+  if(!pending.empty()){
+    pool->parallelFor(pending.size(), [&](size_t i){
+      std::vector<BuildRange> none;
+      std::vector<Node<Key, Value>*> order;
+      buildRange(nodes, pending[i], -1, none, order);
+    });
+  }
 
-    // If right child isnt nullptr, we'll make it the root
-    else if (root_->getRight() != nullptr){
-      root_ = root_->getRight();
+  // The nodes above the cut go last, once their subtrees are done
+  for(size_t i = top.size(); i > 0; --i){
+    refreshNode(top[i - 1]);
+  }
+}
+
+/**
+* Builds the subtree for one range with an explicit stack. Ranges at
+* cutDepth (if it isn't -1) are left in pending instead. Children come
+* after their parents in order, so refreshing it backwards goes
+* bottom-up; that is done here for complete subtrees.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::buildRange(std::vector<Node<Key, Value>*>& nodes, const BuildRange& start, int cutDepth,
+                                              std::vector<BuildRange>& pending, std::vector<Node<Key, Value>*>& order)
+{
+  std::vector<BuildRange> ranges(1, start);
+  while(!ranges.empty()){
+    BuildRange range = ranges.back();
+    ranges.pop_back();
+
+    if(range.depth == cutDepth){
+      pending.push_back(range);
+      continue;
     }
 
-    // If no children, set root to nullptr
+    size_t mid = range.lo + (range.hi - range.lo) / 2;
+    Node<Key, Value>* node = nodes[mid];
+    node->setParent(range.parent);
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+    if(range.parent == nullptr){
+      root_ = node;
+    }
+    else if(range.isLeft){
+      range.parent->setLeft(node);
+    }
     else{
-      delete root_;
-      root_ = nullptr;
+      range.parent->setRight(node);
+    }
+    // Inside the array the nodes next to the range bound its subtree
+    if(NodeKeyPrefix<Key>::enabled && range.lo > 0 && range.hi < nodes.size()){
+      node->setKeyPrefix(node->getKey(), NodeKeyPrefix<Key>::commonPrefix(nodes[range.lo - 1]->getKey(), nodes[range.hi]->getKey()));
+    }
+    else{
+      refreshKeyPrefix(node);
+    }
+    relinkNode(node, mid - range.lo, range.hi - mid - 1, range.depth);
+    order.push_back(node);
+
+    if(mid + 1 < range.hi){
+      BuildRange right = { mid + 1, range.hi, node, false, range.depth + 1 };
+      ranges.push_back(right);
+    }
+    if(range.lo < mid){
+      BuildRange left = { range.lo, mid, node, true, range.depth + 1 };
+      ranges.push_back(left);
+    }
+  }
+
+  if(cutDepth == -1){
+    for(size_t i = order.size(); i > 0; --i){
+      refreshNode(order[i - 1]);
+    }
+  }
+}
+
+/**
+* Replaces the contents of the tree with the items in [first, last),
+* which can be in any order. For a duplicate key the last item wins, as
+* if they had been inserted one by one (multimap mode keeps them all,
+* in input order). The items are sorted in parallel and the nodes are
+* created and linked into a balanced tree in parallel, O(n log n / p)
+* with no rebalancing at all.
+*/
+template<typename Key, typename Value>
+template<typename InputIt>
+void BinarySearchTree<Key, Value>::buildParallel(InputIt first, InputIt last, WorkStealingPool& pool)
+{
+  clear();
+  std::vector<std::pair<Key, Value> > items(first, last);
+  size_t count = items.size();
+  if(count == 0){
+    return;
+  }
+
+  // Stable sort of one block per worker, then rounds of pairwise merges
+  struct KeyLess {
+    bool operator()(const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) const { return a.first < b.first; }
+  };
+  size_t blocks = std::min(pool.size(), count);
+  std::vector<size_t> bounds(blocks + 1);
+  for(size_t i = 0; i <= blocks; ++i){
+    bounds[i] = count * i / blocks;
+  }
+  pool.parallelFor(blocks, [&](size_t i){
+    std::stable_sort(items.begin() + bounds[i], items.begin() + bounds[i + 1], KeyLess());
+  });
+  for(size_t width = 1; width < blocks; width *= 2){
+    pool.parallelFor((blocks + 2 * width - 1) / (2 * width), [&](size_t i){
+      size_t lo = 2 * width * i;
+      size_t mid = std::min(lo + width, blocks);
+      size_t hi = std::min(lo + 2 * width, blocks);
+      std::inplace_merge(items.begin() + bounds[lo], items.begin() + bounds[mid], items.begin() + bounds[hi], KeyLess());
+    });
+  }
+
+  // Equal keys are next to each other and still in input order
+  if(!multimap_){
+    size_t kept = 0;
+    for(size_t i = 0; i < count; ++i){
+      if(kept > 0 && !(items[kept - 1].first < items[i].first)){
+        items[kept - 1].second = items[i].second;
+      }
+      else{
+        if(kept != i){
+          items[kept] = items[i];
+        }
+        ++kept;
+      }
     }
+    items.erase(items.begin() + kept, items.end());
+    count = kept;
   }
+
+  std::vector<Node<Key, Value>*> nodes(count);
+  size_t chunks = pool.size() * 8;
+  pool.parallelFor(chunks, [&](size_t c){
+    for(size_t i = count * c / chunks; i < count * (c + 1) / chunks; ++i){
+      nodes[i] = createNode(items[i].first, items[i].second, nullptr);
+    }
+  });
+  std::vector<std::pair<Key, Value> >().swap(items);
+
+  adoptNodes(nodes, &pool);
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setCompactThreshold(double fraction)
+{
+  compactThreshold_ = fraction;
 }
 
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::tombstoneCount() const
+{
+  return tombstoneCount_;
+}
 
 /**
-* A helper function to find the smallest node in the tree.
+* Copies the nodes into a new block in layout order, then translates the
+* copies' links: every old node's parent pointer is overwritten with the
+* address of its copy, so old pointers forward to the new nodes without
+* a lookup table. A copy that throws leaves the tree as it was.
 */
 template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+void BinarySearchTree<Key, Value>::relayout(NodeLayout layout)
 {
-  // Just keep going left until you reach the end
-  // I know ive reached the end of the left child of the current node is nullptr
-  
-  // Empty tree
-  if(root_ == nullptr){
-    return nullptr;
+  compact();
+  std::vector<Node<Key, Value>*> order;
+  layoutOrder(layout, order);
+  if(order.empty()){
+    return;
   }
-  
-  Node<Key, Value>* current = root_;
-  while(current->getLeft() != nullptr){
-    current = current->getLeft();
+
+  size_t bytes = nodeSize();
+  char* block = static_cast<char*>(::operator new(order.size() * bytes));
+  std::vector<Node<Key, Value>*> copies;
+  copies.reserve(order.size());
+  try{
+    for(size_t i = 0; i < order.size(); ++i){
+      copies.push_back(relocateNode(order[i], block + i * bytes));
+      if(typeid(*copies.back()) != typeid(*order[i])){
+        throw std::logic_error("relayout: relocateNode() makes a different node type than createNode()");
+      }
+    }
+  }
+  catch(...){
+    for(size_t i = 0; i < copies.size(); ++i){
+      copies[i]->~Node();
+    }
+    ::operator delete(block);
+    throw;
   }
 
-  return current;
+  for(size_t i = 0; i < order.size(); ++i){
+    order[i]->setParent(copies[i]);
+  }
+  for(size_t i = 0; i < copies.size(); ++i){
+    Node<Key, Value>* node = copies[i];
+    Node<Key, Value>* parent = node->getParent();
+    Node<Key, Value>* left = node->getLeft();
+    Node<Key, Value>* right = node->getRight();
+    node->setParent(parent == nullptr ? nullptr : parent->getParent());
+    node->setLeft(left == nullptr ? nullptr : left->getParent());
+    node->setRight(right == nullptr ? nullptr : right->getParent());
+  }
+  root_ = root_->getParent();
+  rightmost_ = (rightmost_ == nullptr) ? nullptr : rightmost_->getParent();
+  std::fill(lookupCache_.begin(), lookupCache_.end(), (Node<Key, Value>*)nullptr);
+
+  // Freeing the old nodes also releases the previous block, if any
+  for(size_t i = 0; i < order.size(); ++i){
+    freeNode(order[i]);
+  }
+  nodeBlock_ = block;
+  nodeBlockBytes_ = order.size() * bytes;
+  nodeBlockLive_ = order.size();
 }
 
 /**
-* Helper function to find a node with given key, k and
-* return a pointer to it or NULL if no item with that key
-* exists
+* van Emde Boas order: a piece (top node, levels) is laid out as the piece
+* of its first levels / 2 levels followed by the pieces rooted right below
+* those, left to right. Kept on an explicit stack. Each halving of the
+* levels walks every node at most twice, so for height h this is
+* O(n log h): O(n log log n) for a balanced tree, but O(n log n) for a
+* degenerate one.
 */
 template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+void BinarySearchTree<Key, Value>::layoutOrder(NodeLayout layout, std::vector<Node<Key, Value>*>& order) const
 {
-  // Empty tree
+  order.clear();
   if(root_ == nullptr){
-    return nullptr;
+    return;
+  }
+  order.reserve(nodeCount_);
+
+  if(layout == LAYOUT_BFS){
+    order.push_back(root_);
+    for(size_t i = 0; i < order.size(); ++i){
+      for(int side = 0; side < 2; ++side){
+        if(order[i]->getChild(side) != nullptr){
+          order.push_back(order[i]->getChild(side));
+        }
+      }
+    }
+    return;
   }
 
-  Node<Key, Value>* current = root_;
-  // Iterate through tree until we reach the node with the right key
-  while(current != nullptr){
-    if(current->getItem().first == key){
-      return current;
+  std::vector<std::pair<Node<Key, Value>*, int> > pieces(1, std::make_pair(root_, findHeight(root_)));
+  std::vector<std::pair<Node<Key, Value>*, int> > walk;
+  std::vector<Node<Key, Value>*> below;
+  while(!pieces.empty()){
+    Node<Key, Value>* top = pieces.back().first;
+    int levels = pieces.back().second;
+    pieces.pop_back();
+    if(levels == 1){
+      order.push_back(top);
+      continue;
     }
-    
-    if(key < current->getItem().first){
-      current = current->getLeft();
+
+    int upper = levels / 2;
+    below.clear();
+    walk.assign(1, std::make_pair(top, 0));
+    while(!walk.empty()){
+      Node<Key, Value>* node = walk.back().first;
+      int depth = walk.back().second;
+      walk.pop_back();
+      if(depth == upper){
+        below.push_back(node);
+        continue;
+      }
+      // Right goes on first so below fills left to right
+      for(int side = 1; side >= 0; --side){
+        if(node->getChild(side) != nullptr){
+          walk.push_back(std::make_pair(node->getChild(side), depth + 1));
+        }
+      }
     }
-    else if(key > current->getItem().first){
-      current = current->getRight();
+    // Popped in reverse: the top piece first, then below left to right
+    for(size_t i = below.size(); i > 0; --i){
+      pieces.push_back(std::make_pair(below[i - 1], levels - upper));
     }
+    pieces.push_back(std::make_pair(top, upper));
   }
+}
 
-  // Return nullptr if the key was never found
-  return nullptr;
+/**
+* Called by compact() and buildParallel() for every node they link. A
+* plain BST has no balance data to reset.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::relinkNode(Node<Key, Value>* node, size_t leftSize, size_t rightSize, int depth)
+{
 
 }
 
-// HELPER FUNCTIONS FOR isBalanced()
-////////////////////////////////////
+/**
+* Iterator to node, or to the next live node if node is a tombstone.
+*/
 template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::findHeight(Node<Key, Value>* node) const{
-  
-  // Recursively find the height of the tree
-  if(node == nullptr){
-    return 0;
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::firstLive(Node<Key, Value>* node) const
+{
+  iterator it(node);
+  if(node != nullptr && node->isTombstone()){
+    ++it;
   }
+  return withStepLatency(it);
+}
 
-  int lheight = findHeight(node->getLeft());
-  int rheight = findHeight(node->getRight());
-
-  return std::max(lheight, rheight) + 1;
-
+/**
+* insert()'s overwrite case: stores value and keeps the value sizer's
+* total right. Overwriting a tombstoned key brings it back to life.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::overwriteNode(Node<Key, Value>* node, const Value& value)
+{
+  if(valueSizer_){
+    valueBytes_ -= deepSize(node);
+    node->setValue(value);
+    valueBytes_ += deepSize(node);
+  }
+  else{
+    node->setValue(value);
+  }
+  if(node->isTombstone()){
+    node->setTombstone(false);
+    --tombstoneCount_;
+  }
 }
 
+/**
+* Walks the tree down to the depth where there are at least pieces
+* subtrees (or the tree runs out). The nodes above that depth become
+* single-node pieces between their two subtrees.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::splitForParallel(size_t pieces, std::vector<std::pair<Node<Key, Value>*, bool> >& chunks) const
+{
+  int cutDepth = 0;
+  for(size_t n = 1; n < pieces; n *= 2){
+    ++cutDepth;
+  }
 
+  // (node, depth, visited): a node is pushed once to expand it and once
+  // more, between its children, to emit it on its own
+  struct Frame {
+    Node<Key, Value>* node;
+    int depth;
+    bool visited;
+  };
+  std::vector<Frame> stack;
+  Frame rootFrame = { root_, 0, false };
+  stack.push_back(rootFrame);
+  while(!stack.empty()){
+    Frame frame = stack.back();
+    stack.pop_back();
+    if(frame.node == nullptr){
+      continue;
+    }
+    if(frame.depth == cutDepth){
+      chunks.push_back(std::make_pair(frame.node, true));
+    }
+    else if(frame.visited){
+      chunks.push_back(std::make_pair(frame.node, false));
+    }
+    else{
+      Frame right = { frame.node->getRight(), frame.depth + 1, false };
+      Frame self = { frame.node, frame.depth, true };
+      Frame left = { frame.node->getLeft(), frame.depth + 1, false };
+      stack.push_back(right);
+      stack.push_back(self);
+      stack.push_back(left);
+    }
+  }
+}
 
+/**
+* In-order walk of one piece with an explicit stack. Tombstones are skipped.
+*/
 template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::balanceHelper(Node<Key, Value>* node) const{
-  
-  if(node == nullptr){
-    return true;
+template<typename Fn>
+void BinarySearchTree<Key, Value>::forEachInChunk(const std::pair<Node<Key, Value>*, bool>& chunk, Fn& fn)
+{
+  if(!chunk.second){
+    if(!chunk.first->isTombstone()){
+      fn(chunk.first->getItem());
+    }
+    return;
   }
 
-  int lheight = findHeight(node->getLeft());
-  int rheight = findHeight(node->getRight());
+  walkInOrder(chunk.first, (size_t)-1, fn);
+}
 
-  bool currentBalanced = std::abs(lheight - rheight) <= 1;
+/**
+* In-order walk of the subtree under root with an explicit stack, calling
+* fn on up to limit live items. Right children are prefetched on the way
+* down, since the walk comes back for them soon after. Returns how many
+* items fn saw.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+size_t BinarySearchTree<Key, Value>::walkInOrder(Node<Key, Value>* root, size_t limit, Fn& fn)
+{
+  size_t visited = 0;
+  std::vector<Node<Key, Value>*> stack;
+  Node<Key, Value>* current = root;
+  while(visited < limit && (current != nullptr || !stack.empty())){
+    while(current != nullptr){
+      stack.push_back(current);
+      BST_PREFETCH(current->getRight());
+      current = current->getLeft();
+    }
+    current = stack.back();
+    stack.pop_back();
+    if(!current->isTombstone()){
+      fn(current->getItem());
+      ++visited;
+    }
+    current = current->getRight();
+  }
+  return visited;
+}
 
-  bool leftBalanced = balanceHelper(node->getLeft());
-  bool rightBalanced = balanceHelper(node->getRight());
+/**
+* Copies the keys, in order, into out (room for capacity of them) in one
+* walk. Returns how many were written: size(), or capacity if the tree
+* doesn't fit.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::exportKeys(Key* out, size_t capacity) const
+{
+  auto copy = [&](const std::pair<const Key, Value>& item){ *out++ = item.first; };
+  return walkInOrder(root_, capacity, copy);
+}
 
-  return currentBalanced && leftBalanced && rightBalanced;
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::exportValues(Value* out, size_t capacity) const
+{
+  auto copy = [&](const std::pair<const Key, Value>& item){ *out++ = item.second; };
+  return walkInOrder(root_, capacity, copy);
+}
 
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::exportItems(std::pair<Key, Value>* out, size_t capacity) const
+{
+  auto copy = [&](const std::pair<const Key, Value>& item){
+    out->first = item.first;
+    out->second = item.second;
+    ++out;
+  };
+  return walkInOrder(root_, capacity, copy);
 }
 
 /**
- * Return true iff the BST is balanced.
- */
+* Replaces the contents of the tree with count items that are already
+* sorted by key, in O(n) with no comparisons beyond the order check.
+* Duplicates are handled like buildParallel(). Throws
+* std::invalid_argument (leaving the tree empty) if the keys aren't sorted.
+*/
 template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+void BinarySearchTree<Key, Value>::importSorted(const std::pair<Key, Value>* items, size_t count)
 {
-  return balanceHelper(root_);
+  importSortedItems(items, count, [](const std::pair<Key, Value>& item) -> const Key& { return item.first; },
+                    [](const std::pair<Key, Value>& item) -> const Value& { return item.second; });
+}
 
+/**
+* Same as above, with the keys and values in two parallel arrays.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::importSorted(const Key* keys, const Value* values, size_t count)
+{
+  // Walk the two arrays with a pointer into keys, and find the matching
+  // value by offset
+  importSortedItems(keys, count, [](const Key& key) -> const Key& { return key; },
+                    [&](const Key& key) -> const Value& { return values[&key - keys]; });
 }
 
+template<typename Key, typename Value>
+template<typename T, typename GetKey, typename GetValue>
+void BinarySearchTree<Key, Value>::importSortedItems(const T* items, size_t count, GetKey getKey, GetValue getValue)
+{
+  clear();
+  std::vector<Node<Key, Value>*> nodes;
+  nodes.reserve(count);
+  for(size_t i = 0; i < count; ++i){
+    const Key& key = getKey(items[i]);
+    if(!nodes.empty() && !(nodes.back()->getKey() < key)){
+      if(key < nodes.back()->getKey()){
+        for(size_t j = 0; j < nodes.size(); ++j){
+          delete nodes[j];
+        }
+        throw std::invalid_argument("importSorted: keys are not sorted");
+      }
+      // Same key again: last one wins unless this is a multimap
+      if(!multimap_){
+        nodes.back()->setValue(getValue(items[i]));
+        continue;
+      }
+    }
+    nodes.push_back(createNode(key, getValue(items[i]), nullptr));
+  }
+  adoptNodes(nodes, nullptr);
+}
 
+/**
+* Takes ownership of freshly created, sorted nodes as the whole tree.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::adoptNodes(std::vector<Node<Key, Value>*>& nodes, WorkStealingPool* pool)
+{
+  nodeCount_ = nodes.size();
+  valueBytes_ = 0;
+  if(valueSizer_){
+    for(size_t i = 0; i < nodes.size(); ++i){
+      valueBytes_ += deepSize(nodes[i]);
+    }
+  }
+  linkBalanced(nodes, pool);
+  rightmost_ = nodes.empty() ? nullptr : nodes.back();
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::merge(BinarySearchTree& other, MergePolicy policy)
+{
+  if(policy == MERGE_KEEP_LEFT){
+    merge(other, [](const Value& left, const Value& right) -> const Value& { return left; });
+  }
+  else{
+    merge(other, [](const Value& left, const Value& right) -> const Value& { return right; });
+  }
+}
+
+/**
+* Flattens both trees, merges the two sorted node lists and relinks the
+* result into a balanced tree. Nodes are moved rather than copied, so
+* the merge never holds two copies of the data. Only when other is a
+* different kind of tree are its items copied into new nodes.
+*/
+template<typename Key, typename Value>
+template<typename Combine>
+void BinarySearchTree<Key, Value>::merge(BinarySearchTree& other, Combine combine)
+{
+  if(&other == this){
+    return;
+  }
+
+  std::vector<Node<Key, Value>*> left;
+  std::vector<Node<Key, Value>*> right;
+  takeNodes(root_, left);
+  other.takeNodes(other.root_, right);
+  other.root_ = nullptr;
+  other.rightmost_ = nullptr;
+  other.nodeCount_ = 0;
+  other.valueBytes_ = 0;
+  std::fill(other.lookupCache_.begin(), other.lookupCache_.end(), (Node<Key, Value>*)nullptr);
+  // Nodes in other's relayout block can't change hands, they are copied
+  bool adopt = typeid(*this) == typeid(other) && other.nodeBlock_ == nullptr;
+
+  std::vector<Node<Key, Value>*> merged;
+  merged.reserve(left.size() + right.size());
+  size_t i = 0;
+  size_t j = 0;
+  while(i < left.size() || j < right.size()){
+    // On equal keys the left node goes first
+    if(j == right.size() || (i < left.size() && !(right[j]->getKey() < left[i]->getKey()))){
+      merged.push_back(left[i++]);
+      continue;
+    }
+
+    Node<Key, Value>* node = right[j++];
+    if(!multimap_ && !merged.empty() && !(merged.back()->getKey() < node->getKey())){
+      merged.back()->setValue(combine(merged.back()->getValue(), node->getValue()));
+      other.freeNode(node);
+    }
+    else if(adopt){
+      merged.push_back(node);
+    }
+    else{
+      merged.push_back(createNode(node->getKey(), node->getValue(), nullptr));
+      other.freeNode(node);
+    }
+  }
+  adoptNodes(merged, nullptr);
+}
+
+template<typename Key, typename Value>
+TreeShape BinarySearchTree<Key, Value>::shape() const
+{
+  return treeShape(root_);
+}
+
+template<typename Key, typename Value>
+TreeShape BinarySearchTree<Key, Value>::shape(WorkStealingPool& pool) const
+{
+  return treeShape(root_, pool);
+}
+
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::equalPaths(WorkStealingPool& pool) const
+{
+  return equalPathsParallel(root_, pool);
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::describeNode(const Node<Key, Value>* node, ExportFields& fields) const
+{
+  if(node->isTombstone()){
+    fields.push_back(ExportField("tombstone", "true", true));
+  }
+}
+
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::exportTop(const Key& top) const
+{
+  Node<Key, Value>* node = internalFind(top);
+  if(node == nullptr){
+    throw std::out_of_range("Invalid key");
+  }
+  return node;
+}
+
+/**
+* Formats the key and value with operator<< and asks describeNode() for
+* the rest, then streams the subtree under top as DOT or JSON.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportTree(std::ostream& os, const Node<Key, Value>* top, const ExportOptions& options, bool dot) const
+{
+  ExportText buf;
+  std::ostream text(&buf);
+  auto describe = [&](const Node<Key, Value>* node, ExportFields& fields){
+    buf.text.clear();
+    text << node->getKey();
+    fields.push_back(ExportField("key", buf.text, exportJsonBare(node->getKey())));
+    if(options.values){
+      buf.text.clear();
+      text << node->getValue();
+      fields.push_back(ExportField("value", buf.text, exportJsonBare(node->getValue())));
+    }
+    describeNode(node, fields);
+  };
+  if(dot){
+    writeTreeDot(os, top, options, describe);
+  }
+  else{
+    writeTreeJson(os, top, options, describe);
+  }
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportDot(std::ostream& os, const ExportOptions& options) const
+{
+  exportTree(os, root_, options, true);
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportDot(std::ostream& os, const Key& top, const ExportOptions& options) const
+{
+  exportTree(os, exportTop(top), options, true);
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportJson(std::ostream& os, const ExportOptions& options) const
+{
+  exportTree(os, root_, options, false);
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportJson(std::ostream& os, const Key& top, const ExportOptions& options) const
+{
+  exportTree(os, exportTop(top), options, false);
+}
+
+template<typename Key, typename Value>
+MemoryUsage BinarySearchTree<Key, Value>::memoryUsage() const
+{
+  MemoryUsage usage;
+  size_t bytes = nodeSize();
+  usage.nodes = nodeCount_;
+  usage.nodeBytes = nodeCount_ * bytes;
+  usage.slackBytes = (nodeCount_ - nodeBlockLive_) * mallocSlack(bytes);
+  if(nodeBlock_ != nullptr){
+    usage.slackBytes += nodeBlockBytes_ - nodeBlockLive_ * bytes + mallocSlack(nodeBlockBytes_);
+  }
+  usage.valueBytes = valueBytes_;
+  usage.treeBytes = sizeof(*this) + lookupCache_.capacity() * sizeof(Node<Key, Value>*);
+  for(size_t i = 0; i < latencyHistograms_.size(); ++i){
+    usage.treeBytes += latencyHistograms_[i].bytes();
+  }
+  return usage;
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setValueSizer(std::function<size_t(const Key&, const Value&)> sizer)
+{
+  valueSizer_ = sizer;
+  valueBytes_ = 0;
+  if(valueSizer_){
+    auto add = [&](const Node<Key, Value>* node, int, bool) -> bool {
+      valueBytes_ += deepSize(node);
+      return true;
+    };
+    walkShape(static_cast<const Node<Key, Value>*>(root_), 0, add);
+  }
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::deepSize(const Node<Key, Value>* node) const
+{
+  return valueSizer_ ? valueSizer_(node->getKey(), node->getValue()) : 0;
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::nodeSize() const
+{
+  return sizeof(Node<Key, Value>);
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::size() const
+{
+  return nodeCount_ - tombstoneCount_;
+}
+
+template<typename Key, typename Value>
+template<typename Fn>
+void BinarySearchTree<Key, Value>::parallelForEach(Fn fn, bool ordered, WorkStealingPool& pool) const
+{
+  // A few pieces per worker so stealing can even out lopsided subtrees
+  std::vector<std::pair<Node<Key, Value>*, bool> > chunks;
+  splitForParallel(pool.size() * 8, chunks);
+
+  if(!ordered){
+    pool.parallelFor(chunks.size(), [&](size_t i){
+      Fn local = fn;
+      forEachInChunk(chunks[i], local);
+    });
+    return;
+  }
+
+  // Whichever thread finishes the next piece due hands it, and any
+  // finished pieces after it, to fn
+  typedef const std::pair<const Key, Value>* ItemPtr;
+  std::vector<std::vector<ItemPtr> > buffers(chunks.size());
+  std::vector<bool> done(chunks.size(), false);
+  size_t next = 0;
+  std::mutex emitLock;
+
+  pool.parallelFor(chunks.size(), [&](size_t i){
+    std::vector<ItemPtr> items;
+    auto collect = [&](const std::pair<const Key, Value>& item){
+      items.push_back(&item);
+    };
+    forEachInChunk(chunks[i], collect);
+
+    std::lock_guard<std::mutex> guard(emitLock);
+    buffers[i].swap(items);
+    done[i] = true;
+    while(next < chunks.size() && done[next]){
+      for(size_t j = 0; j < buffers[next].size(); ++j){
+        fn(*buffers[next][j]);
+      }
+      std::vector<ItemPtr>().swap(buffers[next]);
+      ++next;
+    }
+  });
+}
+
+template<typename Key, typename Value>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value>::parallelReduce(T init, Map map, Combine combine, bool ordered, WorkStealingPool& pool) const
+{
+  std::vector<std::pair<Node<Key, Value>*, bool> > chunks;
+  splitForParallel(pool.size() * 8, chunks);
+
+  std::vector<T> partials(ordered ? chunks.size() : 0, init);
+  T total = init;
+  std::mutex totalLock;
+
+  pool.parallelFor(chunks.size(), [&](size_t i){
+    T partial = init;
+    auto fold = [&](const std::pair<const Key, Value>& item){
+      partial = combine(partial, map(item));
+    };
+    forEachInChunk(chunks[i], fold);
+    if(ordered){
+      partials[i] = partial;
+    }
+    else{
+      std::lock_guard<std::mutex> guard(totalLock);
+      total = combine(total, partial);
+    }
+  });
+
+  for(size_t i = 0; i < partials.size(); ++i){
+    total = combine(total, partials[i]);
+  }
+  return total;
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setMultimap(bool multimap)
+{
+  multimap_ = multimap;
+}
+
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::isMultimap() const
+{
+  return multimap_;
+}
+
+/**
+* Returns [first item with key, first item past key). Both are end()
+* when the key isn't in the tree.
+*/
+template<typename Key, typename Value>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, typename BinarySearchTree<Key, Value>::iterator>
+BinarySearchTree<Key, Value>::equal_range(const Key& key) const
+{
+  iterator first = firstLive(lowerBound(key));
+  if(first == end() || key < first->first){
+    return std::make_pair(end(), end());
+  }
+  return std::make_pair(first, firstLive(upperBound(key)));
+}
+
+/**
+* Number of items with the given key, O(log n + count)
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::count(const Key& key) const
+{
+  size_t total = 0;
+  for(iterator it = firstLive(lowerBound(key)); it != end() && !(key < it->first); ++it){
+    ++total;
+  }
+  return total;
+}
+
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator pos)
+{
+  LatencyTimer timer(latencyFor(LATENCY_REMOVE));
+  Node<Key, Value>* current = pos.current_;
+  if(current == nullptr){
+    return end();
+  }
+  // Removal only moves nodes around, so the successor stays valid. The
+  // step is part of the removal, not a timed step of its own.
+  std::vector<LatencyHistogram>* latency = pos.latency_;
+  pos.latency_ = nullptr;
+  ++pos;
+  pos.latency_ = latency;
+  removeNode(current);
+  return pos;
+}
+
+/**
+* One erase() per item, unless the range is the whole tree.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator first, iterator last)
+{
+  if(first == begin() && last == end()){
+    clear();
+    return end();
+  }
+  while(first != last){
+    first = erase(first);
+  }
+  return last;
+}
+
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::cursor
+BinarySearchTree<Key, Value>::cursorAt(iterator pos)
+{
+  return cursor(this, withStepLatency(pos));
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::removeRange(const Key& lo, const Key& hi)
+{
+  size_t removed = 0;
+  if(hi < lo){
+    return removed;
+  }
+  iterator it = firstLive(lowerBound(lo));
+  while(it != end() && !(hi < it->first)){
+    it = erase(it);
+    ++removed;
+  }
+  return removed;
+}
+
+/**
+* First node whose key is not less than key, or nullptr. Rotations can
+* put equal keys on either side of each other, so this can't stop at
+* the first match.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::lowerBound(const Key& key) const
+{
+  return KeyDescent<Key>::lowerBound(root_, key);
+}
+
+/**
+* First node whose key is greater than key, or nullptr.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::upperBound(const Key& key) const
+{
+  return KeyDescent<Key>::upperBound(root_, key);
+}
+
+template<class Key, class Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+{
+  // 1st case: Current node has left child
+  if(current->getLeft() != nullptr){
+    Node<Key, Value>* temp = current->getLeft();
+    while(temp->getRight() != nullptr){
+      temp = temp->getRight();
+    }
+
+    return temp;
+  }
+
+  // 2nd case: Current node doesn't have a left child
+  else{
+    Node<Key, Value>* parent = current->getParent();
+    while(parent != nullptr && current == parent->getLeft()){
+      current = parent;
+      parent = parent->getParent();
+    }
+
+    return parent;
+  }
+}
+
+
+/**
+* A method to remove all contents of the tree and
+* reset the values in the tree for use again.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::clear()
+{
+  // Straightforward
+  // Keep walking down to a leaf, delete it and continue from its
+  // parent. No recursion, so any tree shape is fine.
+  Node<Key, Value>* current = root_;
+  while(current != nullptr){
+
+    // Go left if we can, then right
+    if(current->getLeft() != nullptr){
+      current = current->getLeft();
+    }
+    else if(current->getRight() != nullptr){
+      current = current->getRight();
+    }
+
+    // No children -> unlink from the parent and delete
+    else{
+      Node<Key, Value>* parent = current->getParent();
+      if(parent != nullptr){
+        if(parent->getLeft() == current){
+          parent->setLeft(nullptr);
+        }
+        else{
+          parent->setRight(nullptr);
+        }
+      }
+      freeNode(current);
+      current = parent;
+    }
+  }
+  root_ = nullptr;
+  rightmost_ = nullptr;
+  nodeCount_ = 0;
+  tombstoneCount_ = 0;
+  valueBytes_ = 0;
+  std::fill(lookupCache_.begin(), lookupCache_.end(), (Node<Key, Value>*)nullptr);
+}
+
+
+/**
+* A helper function to find the smallest node in the tree.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::getSmallestNode() const
+{
+  // Just keep going left until you reach the end
+  // I know ive reached the end of the left child of the current node is nullptr
+  
+  // Empty tree
+  if(root_ == nullptr){
+    return nullptr;
+  }
+  
+  Node<Key, Value>* current = root_;
+  while(current->getLeft() != nullptr){
+    current = current->getLeft();
+  }
+
+  return current;
+}
+
+/**
+* A helper function to find the largest node in the tree. The answer is
+* cached in rightmost_ until that node is removed.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::getLargestNode() const
+{
+  if(rightmost_ == nullptr && root_ != nullptr){
+    Node<Key, Value>* current = root_;
+    while(current->getRight() != nullptr){
+      current = current->getRight();
+    }
+    rightmost_ = current;
+  }
+  return rightmost_;
+}
+
+/**
+* Climbs from start to the lowest ancestor whose subtree must contain key
+* (if it is in the tree at all), so a normal descent can finish from
+* there. Only ancestors between start and key are visited on the way up.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::fingerStart(Node<Key, Value>* start, const Key& key) const
+{
+  Node<Key, Value>* current = start;
+
+  if(key < start->getKey()){
+    // Going up from a right child crosses a lower bound; stop once that
+    // bound is below key
+    while(current->getParent() != nullptr){
+      Node<Key, Value>* parent = current->getParent();
+      if(current == parent->getRight() && parent->getKey() < key){
+        break;
+      }
+      current = parent;
+    }
+  }
+  // In multimap mode an equal key may also sit above start, so climb
+  // the same way as for a bigger key
+  else if(key > start->getKey() || multimap_){
+    // Mirror image: left children are bounded above by their parent
+    while(current->getParent() != nullptr){
+      Node<Key, Value>* parent = current->getParent();
+      if(current == parent->getLeft() && key < parent->getKey()){
+        break;
+      }
+      current = parent;
+    }
+  }
+
+  return current;
+}
+
+/**
+* Creates the node for keyValuePair, hangs it under parent (or makes it
+* the root when parent is nullptr) and lets the subclass rebalance.
+* parent must be where a normal descent for the key would end;
+* prefixOffset is the node's key prefix offset if the caller knows it
+* (SIZE_MAX to work it out from the ancestors).
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::attachNode(Node<Key, Value>* parent, const std::pair<const Key, Value>& keyValuePair,
+                                         size_t prefixOffset)
+{
+  Node<Key, Value>* node = createNode(keyValuePair.first, keyValuePair.second, parent);
+  ++nodeCount_;
+  valueBytes_ += deepSize(node);
+
+  if(parent == nullptr){
+    root_ = node;
+  }
+  else if(keyValuePair.first < parent->getKey()){
+    parent->setLeft(node);
+  }
+  else{
+    parent->setRight(node);
+  }
+  if(prefixOffset == SIZE_MAX){
+    refreshKeyPrefix(node);
+  }
+  else{
+    node->setKeyPrefix(node->getKey(), prefixOffset);
+  }
+
+  // Equal keys only get here in multimap mode, where they go after the old ones
+  if(rightmost_ != nullptr && !(keyValuePair.first < rightmost_->getKey())){
+    rightmost_ = node;
+  }
+
+  rebalanceInsert(node);
+  refreshPath(node);
+  return node;
+}
+
+/**
+* Every key under node lies between the nearest ancestors on its left
+* and right, so they all share those two keys' common prefix (nothing
+* with a side open). Removals that pull a subtree up can leave deeper
+* prefixes behind; those only make comparisons fall back to the key.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::refreshKeyPrefix(Node<Key, Value>* node)
+{
+  if(!NodeKeyPrefix<Key>::enabled){
+    return;
+  }
+  Node<Key, Value>* low = nullptr;
+  Node<Key, Value>* high = nullptr;
+  Node<Key, Value>* child = node;
+  for(Node<Key, Value>* parent = node->getParent(); parent != nullptr && (low == nullptr || high == nullptr);
+      parent = parent->getParent()){
+    if(parent->getLeft() == child){
+      high = (high == nullptr) ? parent : high;
+    }
+    else{
+      low = (low == nullptr) ? parent : low;
+    }
+    child = parent;
+  }
+  size_t offset = 0;
+  if(low != nullptr && high != nullptr){
+    offset = NodeKeyPrefix<Key>::commonPrefix(low->getKey(), high->getKey());
+  }
+  node->setKeyPrefix(node->getKey(), offset);
+}
+
+/**
+* up takes over current's old bounds, so current's old offset. current
+* keeps its bound B on outer's side and gets up's key as the other one;
+* lcp(B, current) is outer's offset, and with no outer the old offset
+* is a lower bound. Too small an offset only costs a key read in the
+* descent, never a wrong answer.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateKeyPrefix(Node<Key, Value>* current, Node<Key, Value>* up,
+                                                   Node<Key, Value>* outer, size_t currentOffset)
+{
+  if(!NodeKeyPrefix<Key>::enabled){
+    return;
+  }
+  up->setKeyPrefix(up->getKey(), currentOffset);
+  size_t offset = currentOffset;
+  if(outer != nullptr){
+    offset = std::min(outer->prefixOffset(), NodeKeyPrefix<Key>::commonPrefix(current->getKey(), up->getKey()));
+  }
+  current->setKeyPrefix(current->getKey(), offset);
+}
+
+/**
+* Frees a node that has already been unlinked from the tree.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::destroyNode(Node<Key, Value>* node)
+{
+  if(node == rightmost_){
+    rightmost_ = nullptr;
+  }
+  if(node->isTombstone()){
+    --tombstoneCount_;
+  }
+  --nodeCount_;
+  valueBytes_ -= deepSize(node);
+  if(!lookupCache_.empty()){
+    Node<Key, Value>*& cached = lookupCache_[lookupCacheSlot(node->getKey())];
+    if(cached == node){
+      cached = nullptr;
+    }
+  }
+  freeNode(node);
+}
+
+/**
+* Node factory. Subclasses that need a bigger node (AVLNode, RBNode...)
+* override this.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+  return new Node<Key, Value>(key, value, parent);
+}
+
+/**
+* Copy factory for relayout(). Subclasses that override createNode()
+* override this too.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::relocateNode(const Node<Key, Value>* node, void* where) const
+{
+  return new (where) Node<Key, Value>(*node);
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::freeNode(Node<Key, Value>* node)
+{
+  char* address = reinterpret_cast<char*>(node);
+  if(nodeBlock_ == nullptr || address < nodeBlock_ || address >= nodeBlock_ + nodeBlockBytes_){
+    delete node;
+    return;
+  }
+  node->~Node();
+  if(--nodeBlockLive_ == 0){
+    ::operator delete(nodeBlock_);
+    nodeBlock_ = nullptr;
+    nodeBlockBytes_ = 0;
+  }
+}
+
+/**
+* Called right after a new node is linked in. A plain BST doesn't
+* rebalance.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebalanceInsert(Node<Key, Value>* node)
+{
+
+}
+
+/**
+* Recomputes whatever a subclass stores about node's subtree, assuming
+* its children are already up to date. Nothing to do for a plain BST.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::refreshNode(Node<Key, Value>* node)
+{
+
+}
+
+/**
+* Called after node's subtree changed (insert, value overwrite, remove
+* below it) so that node and all of its ancestors can be recomputed.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::refreshPath(Node<Key, Value>* node)
+{
+
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::accessNode(Node<Key, Value>* node)
+{
+
+}
+
+/**
+* insert()'s descent, except that a node that is already there is kept
+* as it is. A tombstone is brought back to life with make(). Multimap
+* trees need a search first, since their descent for a new node goes
+* past the equal keys.
+*/
+template<typename Key, typename Value>
+template<typename Make>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findOrAttach(const Key& key, Make make, bool& inserted)
+{
+  inserted = false;
+  if(multimap_){
+    Node<Key, Value>* found = internalFind(key);
+    if(found != nullptr){
+      accessNode(found);
+      return found;
+    }
+  }
+
+  Node<Key, Value>* parent = nullptr;
+  size_t shared = 0;
+  Node<Key, Value>* current = KeyDescent<Key>::locate(root_, key, multimap_, parent, shared);
+  if(current != nullptr && !current->isTombstone()){
+    accessNode(current);
+    return current;
+  }
+
+  inserted = true;
+  if(current != nullptr){
+    overwriteNode(current, make());
+    refreshPath(current);
+    accessNode(current);
+    return current;
+  }
+  std::pair<const Key, Value> item(key, make());
+  return attachNode(parent, item, shared);
+}
+
+/**
+* Helper function to find a node with given key, k and
+* return a pointer to it or NULL if no item with that key
+* exists
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+{
+  // Empty tree
+  if(root_ == nullptr){
+    return nullptr;
+  }
+
+  // Check the lookup cache first, and remember whatever the descent finds
+  Node<Key, Value>** cached = nullptr;
+  if(!lookupCache_.empty()){
+    cached = &lookupCache_[lookupCacheSlot(key)];
+    if(*cached != nullptr && (*cached)->getKey() == key){
+      ++lookupCacheStats_.hits;
+      return *cached;
+    }
+    ++lookupCacheStats_.misses;
+  }
+
+  // Branch-free for arithmetic keys, see KeyDescent
+  Node<Key, Value>* current = KeyDescent<Key>::find(root_, key);
+  if(current == nullptr){
+    return nullptr;
+  }
+
+  // Lazily removed. With duplicate keys a live copy can still be
+  // around, so fall back to scanning the equal keys in order.
+  if(current->isTombstone()){
+    if(!multimap_){
+      return nullptr;
+    }
+    iterator it = firstLive(lowerBound(key));
+    if(it == end() || key < it->first){
+      return nullptr;
+    }
+    current = it.current_;
+  }
+  if(cached != nullptr){
+    *cached = current;
+  }
+  return current;
+}
+
+/**
+* Turns on the lookup cache with at least the given number of slots
+* (rounded up to a power of two). Any previous contents and counters
+* are dropped.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::enableLookupCache(size_t slots)
+{
+  size_t size = 1;
+  while(size < slots){
+    size *= 2;
+  }
+  lookupCache_.assign(size, nullptr);
+  lookupCacheStats_.hits = 0;
+  lookupCacheStats_.misses = 0;
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::disableLookupCache()
+{
+  std::vector<Node<Key, Value>*>().swap(lookupCache_);
+}
+
+template<typename Key, typename Value>
+LookupCacheStats BinarySearchTree<Key, Value>::lookupCacheStats() const
+{
+  return lookupCacheStats_;
+}
+
+/**
+* Starts (or restarts) latency recording with empty histograms. The
+* tick rate is calibrated here, so the first call takes about 10ms.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::enableLatencyStats()
+{
+  latencyNsPerTick();
+  latencyHistograms_.assign(LATENCY_OPS, LatencyHistogram());
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::disableLatencyStats()
+{
+  std::vector<LatencyHistogram>().swap(latencyHistograms_);
+}
+
+/**
+* A copy of the histograms so far (all empty if stats are off).
+*/
+template<typename Key, typename Value>
+LatencyStats BinarySearchTree<Key, Value>::latencyStats() const
+{
+  LatencyStats stats;
+  for(size_t op = 0; op < latencyHistograms_.size(); ++op){
+    stats.ops[op] = latencyHistograms_[op];
+  }
+  return stats;
+}
+
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::withStepLatency(iterator it) const
+{
+  it.latency_ = latencyHistograms_.empty() ? nullptr : &latencyHistograms_;
+  return it;
+}
+
+template<typename Key, typename Value>
+LatencyHistogram* BinarySearchTree<Key, Value>::latencyFor(LatencyOp op) const
+{
+  return latencyHistograms_.empty() ? nullptr : &latencyHistograms_[op];
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::lookupCacheSlot(const Key& key) const
+{
+  return LookupCacheHash<Key>()(key) & (lookupCache_.size() - 1);
+}
+
+// HELPER FUNCTIONS FOR isBalanced()
+////////////////////////////////////
+// Both helpers walk the subtree with the parent pointers instead of
+// recursing, so a degenerate (linked list shaped) tree can't overflow
+// the call stack.
+template<typename Key, typename Value>
+int BinarySearchTree<Key, Value>::findHeight(Node<Key, Value>* node) const{
+  
+  if(node == nullptr){
+    return 0;
+  }
+
+  // Depth-first walk that stops once we climb back out of node
+  Node<Key, Value>* stop = node->getParent();
+  Node<Key, Value>* current = node;
+  Node<Key, Value>* prev = stop;
+  int depth = 1;
+  int height = 0;
+
+  while(current != stop){
+    Node<Key, Value>* next = nullptr;
+    // Coming down -> try the left child first, then the right one
+    if(prev == current->getParent()){
+      next = (current->getLeft() != nullptr) ? current->getLeft() : current->getRight();
+    }
+    // Coming back up from the left -> the right child is next
+    else if(prev == current->getLeft()){
+      next = current->getRight();
+    }
+
+    prev = current;
+    if(next != nullptr){
+      current = next;
+      ++depth;
+    }
+    // Both children done -> climb back up
+    else{
+      height = std::max(height, depth);
+      current = current->getParent();
+      --depth;
+    }
+  }
+
+  return height;
+
+}
+
+
+
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::balanceHelper(Node<Key, Value>* node) const{
+  
+  if(node == nullptr){
+    return true;
+  }
+
+  // Same walk as findHeight(), but in post-order: when a node is left for
+  // the last time, the heights of its finished children are on top of the
+  // stack (right above left). Each node is only visited once.
+  std::vector<int> heights;
+  Node<Key, Value>* stop = node->getParent();
+  Node<Key, Value>* current = node;
+  Node<Key, Value>* prev = stop;
+
+  while(current != stop){
+    Node<Key, Value>* next = nullptr;
+    if(prev == current->getParent()){
+      next = (current->getLeft() != nullptr) ? current->getLeft() : current->getRight();
+    }
+    else if(prev == current->getLeft()){
+      next = current->getRight();
+    }
+
+    prev = current;
+    if(next != nullptr){
+      current = next;
+      continue;
+    }
+
+    int rheight = 0;
+    int lheight = 0;
+    if(current->getRight() != nullptr){
+      rheight = heights.back();
+      heights.pop_back();
+    }
+    if(current->getLeft() != nullptr){
+      lheight = heights.back();
+      heights.pop_back();
+    }
+
+    if(std::abs(lheight - rheight) > 1){
+      return false;
+    }
+
+    heights.push_back(std::max(lheight, rheight) + 1);
+    current = current->getParent();
+  }
+
+  return true;
+
+}
+
+/**
+ * Return true iff the BST is balanced.
+ */
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::isBalanced() const
+{
+  return balanceHelper(root_);
+
+}
+
+/**
+ * The iterator constructor is only visible to BinarySearchTree, so
+ * subclasses that locate nodes themselves wrap them through here.
+ */
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iteratorAt(Node<Key, Value>* node)
+{
+  return iterator(node);
+}
+
+/**
+ * Rotates current's right child up into current's place. Only the
+ * pointers are touched, so subclasses that keep extra per-node state
+ * (balance, color, ...) adjust it themselves after calling this.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateLeft(Node<Key, Value>* current)
+{
+  Node<Key, Value>* rightChild = current->getRight();
+
+  // Case where there is not rightChild
+  if(rightChild == nullptr){
+    return; // No rotation needed
+  }
+  size_t currentOffset = current->prefixOffset();
+
+  current->setRight(rightChild->getLeft());
+  if(rightChild->getLeft() != nullptr){
+    rightChild->getLeft()->setParent(current);
+  }
+
+  // Making rightChild the new root of this subtree
+  rightChild->setLeft(current);
+  rightChild->setParent(current->getParent());
+
+  // Updating current's parent to rightChild
+  if(current->getParent() != nullptr){
+    if(current->getParent()->getLeft() == current){
+      current->getParent()->setLeft(rightChild);
+    }
+    else{
+      current->getParent()->setRight(rightChild);
+    }
+  }
+  else{
+    // Case if current was the root
+    root_ = rightChild;
+  }
+
+  current->setParent(rightChild);
+
+  rotateKeyPrefix(current, rightChild, current->getLeft(), currentOffset);
+
+  // current is now below rightChild, so it goes first
+  refreshNode(current);
+  refreshNode(rightChild);
+}
+
+/**
+ * Mirror image of rotateLeft(): current's left child moves up.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateRight(Node<Key, Value>* current)
+{
+  Node<Key, Value>* leftChild = current->getLeft();
+
+  // Case where there is not leftChild
+  if(leftChild == nullptr){
+    return; // No rotation needed
+  }
+  size_t currentOffset = current->prefixOffset();
+
+  current->setLeft(leftChild->getRight());
+  if(leftChild->getRight() != nullptr){
+    leftChild->getRight()->setParent(current);
+  }
+
+  // Making leftChild the new root of this subtree
+  leftChild->setRight(current);
+  leftChild->setParent(current->getParent());
+
+  // Updating current's parent to leftChild
+  if(current->getParent() != nullptr){
+    if(current->getParent()->getLeft() == current){
+      current->getParent()->setLeft(leftChild);
+    }
+    else{
+      current->getParent()->setRight(leftChild);
+    }
+  }
+  else{
+    // Case if current was the root
+    root_ = leftChild;
+  }
+
+  current->setParent(leftChild);
+
+  rotateKeyPrefix(current, leftChild, current->getRight(), currentOffset);
+
+  refreshNode(current);
+  refreshNode(leftChild);
+}
 
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
@@ -870,6 +3496,11 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
         this->root_ = n1;
     }
 
+    // Items stay with their nodes, so lookup cache entries are still valid.
+    // Each node now sits between the other one's bounds.
+    size_t n1Offset = n1->prefixOffset();
+    n1->setKeyPrefix(n1->getKey(), n2->prefixOffset());
+    n2->setKeyPrefix(n2->getKey(), n1Offset);
 }
 
 /**
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cstdlib>
 #include "equal-paths.h"
+#include "tree-shape.h"
 using namespace std;
 
 
@@ -55,22 +56,63 @@ void test5(const char* msg)
   cout << msg << ": " <<   equalPaths(a) << endl;
 }
 
+// A single path millions of nodes long, to make sure equalPaths
+// doesn't overflow the stack on degenerate trees
+void test6(const char* msg)
+{
+  const int length = 1000000;
+  Node* root = new Node(0);
+  Node* current = root;
+  for(int i = 1; i < length; i++){
+    current->left = new Node(i);
+    current = current->left;
+  }
+  cout << msg << ": " <<   equalPaths(root) << endl;
+  cout << msg << " (parallel): " << equalPathsParallel(root) << endl;
+
+  while(root != NULL){
+    Node* next = root->left;
+    delete root;
+    root = next;
+  }
+}
+
+// One pass of shape statistics over a tree whose leaves sit at depths
+// 1, 2 and 2
+void test7(const char* msg)
+{
+  setNode(a,1,b,c);
+  setNode(b,2,NULL,NULL);
+  setNode(c,3,d,e);
+  setNode(d,4,NULL,NULL);
+  setNode(e,5,NULL,NULL);
+  TreeShape shape = treeShape(a);
+  cout << msg << ": " << shape.nodes << " nodes, " << shape.leaves << " leaves, depths "
+       << shape.minLeafDepth << " to " << shape.maxLeafDepth << ", at depth 2: " << shape.leafDepths[2] << endl;
+  WorkStealingPool pool(2);
+  cout << msg << " (parallel): " << equalPathsParallel(a, pool) << " " << treeShape(a, pool).leaves << endl;
+}
+
 int main()
 {
   a = new Node(1);
   b = new Node(2);
   c = new Node(3);
   d = new Node(4);
+  e = new Node(5);
 
   test1("Test1");
   test2("Test2");
   test3("Test3");
   test4("Test4");
   test5("Test5");
+  test6("Test6");
+  test7("Test7");
  
   delete a;
   delete b;
   delete c;
   delete d;
+  delete e;
 }
 
@@ -1,6 +1,7 @@
 #ifndef RECCHECK
 #include <iostream>
-
+#include <vector>
+#include <utility>
 #endif
 
 #include "equal-paths.h"
@@ -8,23 +9,45 @@ using namespace std;
 
 
 // Need a helper function for checking the depth
+// Walks the tree with an explicit stack of (node, depth) pairs instead of
+// recursing, so very deep trees can't overflow the call stack.
 bool depthCheckHelper(Node* root, int depth, int& leafDepth){
-    if(root == nullptr){
-        return true;
+    vector<pair<Node*, int> > stack;
+    if(root != nullptr){
+        stack.push_back(make_pair(root, depth));
     }
-    // If the current node is a leaf node
-    if(root->left == nullptr && root->right == nullptr){
-        if(leafDepth == -1){
-            leafDepth = depth;
+
+    while(!stack.empty()){
+        Node* current = stack.back().first;
+        int currentDepth = stack.back().second;
+        stack.pop_back();
+
+        // If the current node is a leaf node
+        if(current->left == nullptr && current->right == nullptr){
+            if(leafDepth == -1){
+                leafDepth = currentDepth;
+            }
+            // Stop at the first leaf that doesn't match
+            if(leafDepth != currentDepth){
+                return false;
+            }
+            continue;
+        }
+
+        // Right goes on first so the left subtree is checked first
+        if(current->right != nullptr){
+            stack.push_back(make_pair(current->right, currentDepth + 1));
+        }
+        if(current->left != nullptr){
+            stack.push_back(make_pair(current->left, currentDepth + 1));
         }
-        return (leafDepth == depth);
     }
 
-    return depthCheckHelper(root->left, depth + 1, leafDepth) && depthCheckHelper(root->right, depth + 1, leafDepth);
+    return true;
 }
 
 bool equalPaths(Node * root)
 {
     int leafDepth = -1;
     return depthCheckHelper(root, 0, leafDepth);
-}
\ No newline at end of file
+}
@@ -0,0 +1,769 @@
+#ifndef INTERVALBST_H
+#define INTERVALBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "augavlbst.h"
+
+/**
+* A half-open interval [start, end). Intervals are ordered by start and
+* then by end, so two intervals with the same start are different keys.
+*/
+template <typename Point>
+struct Interval
+{
+    Interval(const Point& s, const Point& e) : start(s), end(e) { }
+
+    Point start;
+    Point end;
+};
+
+template <typename Point>
+bool operator<(const Interval<Point>& a, const Interval<Point>& b)
+{
+    return a.start < b.start || (!(b.start < a.start) && a.end < b.end);
+}
+
+template <typename Point>
+bool operator>(const Interval<Point>& a, const Interval<Point>& b)
+{
+    return b < a;
+}
+
+template <typename Point>
+bool operator==(const Interval<Point>& a, const Interval<Point>& b)
+{
+    return a.start == b.start && a.end == b.end;
+}
+
+template <typename Point>
+bool operator!=(const Interval<Point>& a, const Interval<Point>& b)
+{
+    return !(a == b);
+}
+
+template <typename Point>
+std::ostream& operator<<(std::ostream& os, const Interval<Point>& interval)
+{
+    return os << "[" << interval.start << "," << interval.end << ")";
+}
+
+/**
+* Augmentation policy that keeps the largest end point in a subtree.
+*/
+template <typename Point, typename Value>
+struct MaxEndAugment
+{
+    typedef Point value_type;
+    value_type identity() const { return std::numeric_limits<Point>::lowest(); }
+    value_type lift(const Interval<Point>& key, const Value& value) const { return key.end; }
+    value_type combine(const value_type& a, const value_type& b) const { return a < b ? b : a; }
+};
+
+template <typename Point, typename Value>
+class IntervalIndex;
+
+/**
+* An AugmentedAVLNode that remembers which IntervalIndex lists it, and
+* where in its bucket's two heaps, so it can take itself out of the
+* index when it is freed.
+*/
+template <typename Point, typename Value>
+class IntervalNode : public AugmentedAVLNode<Interval<Point>, Value, Point>
+{
+public:
+    IntervalNode(const Interval<Point>& key, const Value& value, IntervalNode* parent, const Point& maxEnd);
+    // Copies (relayout() makes them) start out in no index
+    IntervalNode(const IntervalNode& other);
+    virtual ~IntervalNode();
+
+    IntervalIndex<Point, Value>* getIndex() const;
+    void setIndex(IntervalIndex<Point, Value>* index);
+    // Position in heap 0 (by start) or 1 (by end) of the bucket
+    uint32_t getSlot(int heap) const;
+    void setSlot(int heap, uint32_t slot);
+
+protected:
+    IntervalIndex<Point, Value>* index_;
+    uint32_t slots_[2];
+};
+
+template<class Point, class Value>
+IntervalNode<Point, Value>::IntervalNode(const Interval<Point>& key, const Value& value, IntervalNode* parent, const Point& maxEnd) :
+    AugmentedAVLNode<Interval<Point>, Value, Point>(key, value, parent, maxEnd), index_(nullptr)
+{
+    slots_[0] = slots_[1] = 0;
+}
+
+template<class Point, class Value>
+IntervalNode<Point, Value>::IntervalNode(const IntervalNode& other) :
+    AugmentedAVLNode<Interval<Point>, Value, Point>(other), index_(nullptr)
+{
+    slots_[0] = slots_[1] = 0;
+}
+
+template<class Point, class Value>
+IntervalNode<Point, Value>::~IntervalNode()
+{
+    if(index_ != nullptr){
+        index_->remove(this);
+    }
+}
+
+template<class Point, class Value>
+IntervalIndex<Point, Value>* IntervalNode<Point, Value>::getIndex() const
+{
+    return index_;
+}
+
+template<class Point, class Value>
+void IntervalNode<Point, Value>::setIndex(IntervalIndex<Point, Value>* index)
+{
+    index_ = index;
+}
+
+template<class Point, class Value>
+uint32_t IntervalNode<Point, Value>::getSlot(int heap) const
+{
+    return slots_[heap];
+}
+
+template<class Point, class Value>
+void IntervalNode<Point, Value>::setSlot(int heap, uint32_t slot)
+{
+    slots_[heap] = slot;
+}
+
+/**
+* A centered interval tree over an IntervalTree's nodes, for stabbing
+* queries in O(log n + k). Every bucket has a center and holds the
+* intervals that contain it, in a min-heap by start and a max-heap by
+* end; intervals that end at or before the center go to the left, ones
+* that start after it to the right. A bucket deeper than log_{3/2} of
+* the size rebuilds the highest bucket on its path with a child holding
+* over 2/3 of it, and shrinking below half the size of the last full
+* rebuild rebuilds everything (scapegoat style), so the depth stays
+* O(log n) for O(log n) amortized updates. Empty and reversed intervals
+* contain no point; they are only counted.
+*/
+template <typename Point, typename Value>
+class IntervalIndex
+{
+public:
+    typedef IntervalNode<Point, Value> NodeType;
+
+    IntervalIndex();
+    ~IntervalIndex();
+
+    // Listed nodes, empty intervals included
+    size_t size() const;
+    void insert(NodeType* node);
+    void remove(NodeType* node);
+    // Lists exactly nodes, taking them out of any other index first
+    void assign(const std::vector<NodeType*>& nodes);
+    void clear();
+    // Calls fn(node) for every listed interval with start <= point < end
+    template<typename Fn>
+    void stab(const Point& point, Fn fn) const;
+
+private:
+    struct Bucket
+    {
+        explicit Bucket(const Point& c) :
+            center(c), firstStart(c), lastEnd(c), left(nullptr), right(nullptr), size(0) { }
+
+        Point center;
+        // The heap tops (center when empty), so a query that finds
+        // nothing here doesn't touch the heaps
+        Point firstStart;
+        Point lastEnd;
+        Bucket* left;
+        Bucket* right;
+        // Intervals in this bucket and every bucket below it
+        size_t size;
+        // heaps[0] has the smallest start on top, heaps[1] the largest end
+        std::vector<NodeType*> heaps[2];
+    };
+
+    IntervalIndex(const IntervalIndex&);
+    IntervalIndex& operator=(const IntervalIndex&);
+
+    // Where key goes below bucket: -1 left, 0 here, 1 right
+    static int route(const Bucket* bucket, const Interval<Point>& key);
+    static bool contains(const Interval<Point>& key);
+    // Whether a belongs above b in the given heap
+    static bool above(int heap, const NodeType* a, const NodeType* b);
+    static void siftUp(std::vector<NodeType*>& nodes, int heap, size_t slot);
+    static void siftDown(std::vector<NodeType*>& nodes, int heap, size_t slot);
+    static void add(Bucket* bucket, NodeType* node);
+    static void erase(Bucket* bucket, NodeType* node);
+    static void refreshBounds(Bucket* bucket);
+    // Pre-order walk of a heap that skips everything under a miss
+    template<typename Hit, typename Fn>
+    static void report(const std::vector<NodeType*>& nodes, Hit hit, Fn& fn);
+    Bucket* build(typename std::vector<NodeType*>::iterator first, typename std::vector<NodeType*>::iterator last);
+    // Appends the subtree's intervals to nodes and frees its buckets
+    static void takeBuckets(Bucket* top, std::vector<NodeType*>& nodes);
+    void rebalance(const Interval<Point>& key);
+
+    Bucket* root_;
+    // Listed nodes that are in no bucket
+    size_t uncentered_;
+    // Largest root_->size since the last full rebuild
+    size_t peak_;
+};
+
+template<class Point, class Value>
+IntervalIndex<Point, Value>::IntervalIndex() :
+    root_(nullptr), uncentered_(0), peak_(0)
+{
+
+}
+
+template<class Point, class Value>
+IntervalIndex<Point, Value>::~IntervalIndex()
+{
+  clear();
+}
+
+template<class Point, class Value>
+size_t IntervalIndex<Point, Value>::size() const
+{
+  return uncentered_ + (root_ == nullptr ? 0 : root_->size);
+}
+
+template<class Point, class Value>
+int IntervalIndex<Point, Value>::route(const Bucket* bucket, const Interval<Point>& key)
+{
+  if(!(bucket->center < key.end)){
+    return -1;
+  }
+  return (bucket->center < key.start) ? 1 : 0;
+}
+
+template<class Point, class Value>
+bool IntervalIndex<Point, Value>::contains(const Interval<Point>& key)
+{
+  return key.start < key.end;
+}
+
+template<class Point, class Value>
+bool IntervalIndex<Point, Value>::above(int heap, const NodeType* a, const NodeType* b)
+{
+  if(heap == 0){
+    return a->getKey().start < b->getKey().start;
+  }
+  return b->getKey().end < a->getKey().end;
+}
+
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::siftUp(std::vector<NodeType*>& nodes, int heap, size_t slot)
+{
+  NodeType* node = nodes[slot];
+  while(slot > 0 && above(heap, node, nodes[(slot - 1) / 2])){
+    nodes[slot] = nodes[(slot - 1) / 2];
+    nodes[slot]->setSlot(heap, slot);
+    slot = (slot - 1) / 2;
+  }
+  nodes[slot] = node;
+  node->setSlot(heap, slot);
+}
+
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::siftDown(std::vector<NodeType*>& nodes, int heap, size_t slot)
+{
+  NodeType* node = nodes[slot];
+  while(2 * slot + 1 < nodes.size()){
+    size_t child = 2 * slot + 1;
+    if(child + 1 < nodes.size() && above(heap, nodes[child + 1], nodes[child])){
+      ++child;
+    }
+    if(!above(heap, nodes[child], node)){
+      break;
+    }
+    nodes[slot] = nodes[child];
+    nodes[slot]->setSlot(heap, slot);
+    slot = child;
+  }
+  nodes[slot] = node;
+  node->setSlot(heap, slot);
+}
+
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::add(Bucket* bucket, NodeType* node)
+{
+  for(int heap = 0; heap < 2; ++heap){
+    bucket->heaps[heap].push_back(node);
+    siftUp(bucket->heaps[heap], heap, bucket->heaps[heap].size() - 1);
+  }
+  refreshBounds(bucket);
+}
+
+/**
+* The last entry of each heap fills the node's slot and moves whichever
+* way it has to.
+*/
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::erase(Bucket* bucket, NodeType* node)
+{
+  for(int heap = 0; heap < 2; ++heap){
+    std::vector<NodeType*>& nodes = bucket->heaps[heap];
+    size_t slot = node->getSlot(heap);
+    NodeType* last = nodes.back();
+    nodes.pop_back();
+    if(slot < nodes.size()){
+      nodes[slot] = last;
+      siftUp(nodes, heap, slot);
+      siftDown(nodes, heap, last->getSlot(heap));
+    }
+  }
+  refreshBounds(bucket);
+}
+
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::refreshBounds(Bucket* bucket)
+{
+  if(bucket->heaps[0].empty()){
+    bucket->firstStart = bucket->center;
+    bucket->lastEnd = bucket->center;
+    return;
+  }
+  bucket->firstStart = bucket->heaps[0][0]->getKey().start;
+  bucket->lastEnd = bucket->heaps[1][0]->getKey().end;
+}
+
+/**
+* A new interval goes into the first bucket on its way down whose center
+* it contains, or into a new leaf bucket centered on its start.
+*/
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::insert(NodeType* node)
+{
+  node->setIndex(this);
+  const Interval<Point>& key = node->getKey();
+  if(!contains(key)){
+    ++uncentered_;
+    return;
+  }
+
+  Bucket** link = &root_;
+  size_t depth = 0;
+  while(*link != nullptr && route(*link, key) != 0){
+    ++(*link)->size;
+    link = (route(*link, key) < 0) ? &(*link)->left : &(*link)->right;
+    ++depth;
+  }
+  bool fresh = (*link == nullptr);
+  if(fresh){
+    *link = new Bucket(key.start);
+  }
+  ++(*link)->size;
+  add(*link, node);
+
+  peak_ = std::max(peak_, root_->size);
+  if(fresh && depth > std::log((double)root_->size) / std::log(1.5)){
+    rebalance(key);
+  }
+}
+
+/**
+* Rebuilds the highest bucket on key's path that has a child on the path
+* holding more than 2/3 of its intervals. One exists whenever the path is
+* longer than log_{3/2} of the size.
+*/
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::rebalance(const Interval<Point>& key)
+{
+  Bucket** link = &root_;
+  while(route(*link, key) != 0){
+    Bucket** next = (route(*link, key) < 0) ? &(*link)->left : &(*link)->right;
+    if(3 * (*next)->size > 2 * (*link)->size){
+      std::vector<NodeType*> nodes;
+      takeBuckets(*link, nodes);
+      *link = build(nodes.begin(), nodes.end());
+      return;
+    }
+    link = next;
+  }
+}
+
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::remove(NodeType* node)
+{
+  node->setIndex(nullptr);
+  const Interval<Point>& key = node->getKey();
+  if(!contains(key)){
+    --uncentered_;
+    return;
+  }
+
+  Bucket* bucket = root_;
+  while(route(bucket, key) != 0){
+    --bucket->size;
+    bucket = (route(bucket, key) < 0) ? bucket->left : bucket->right;
+  }
+  --bucket->size;
+  erase(bucket, node);
+
+  if(2 * root_->size < peak_){
+    std::vector<NodeType*> nodes;
+    takeBuckets(root_, nodes);
+    root_ = build(nodes.begin(), nodes.end());
+    peak_ = nodes.size();
+  }
+}
+
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::assign(const std::vector<NodeType*>& nodes)
+{
+  clear();
+  std::vector<NodeType*> centered;
+  centered.reserve(nodes.size());
+  for(size_t i = 0; i < nodes.size(); ++i){
+    if(nodes[i]->getIndex() != nullptr){
+      nodes[i]->getIndex()->remove(nodes[i]);
+    }
+    nodes[i]->setIndex(this);
+    if(contains(nodes[i]->getKey())){
+      centered.push_back(nodes[i]);
+    }
+    else{
+      ++uncentered_;
+    }
+  }
+  root_ = build(centered.begin(), centered.end());
+  peak_ = centered.size();
+}
+
+/**
+* Only the bucketed nodes can be found again, so clear() is for an index
+* whose uncentered nodes are gone or about to be relisted by assign().
+* The destructor is the other case: the tree's nodes outlive neither.
+*/
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::clear()
+{
+  std::vector<NodeType*> nodes;
+  takeBuckets(root_, nodes);
+  for(size_t i = 0; i < nodes.size(); ++i){
+    nodes[i]->setIndex(nullptr);
+  }
+  root_ = nullptr;
+  uncentered_ = 0;
+  peak_ = 0;
+}
+
+/**
+* Centers every bucket on the median start. At most half the intervals
+* start after it, and every one that ends at or before it also starts
+* before it, so both sides get at most half and the depth is log2(n).
+*/
+template<class Point, class Value>
+typename IntervalIndex<Point, Value>::Bucket*
+IntervalIndex<Point, Value>::build(typename std::vector<NodeType*>::iterator first, typename std::vector<NodeType*>::iterator last)
+{
+  if(first == last){
+    return nullptr;
+  }
+  typename std::vector<NodeType*>::iterator median = first + (last - first - 1) / 2;
+  std::nth_element(first, median, last, [](const NodeType* a, const NodeType* b){
+    return a->getKey().start < b->getKey().start;
+  });
+  Point center = (*median)->getKey().start;
+
+  typename std::vector<NodeType*>::iterator here = std::partition(first, last, [&](const NodeType* node){
+    return !(center < node->getKey().end);
+  });
+  typename std::vector<NodeType*>::iterator right = std::partition(here, last, [&](const NodeType* node){
+    return !(center < node->getKey().start);
+  });
+
+  Bucket* bucket = new Bucket(center);
+  bucket->size = last - first;
+  for(int heap = 0; heap < 2; ++heap){
+    std::vector<NodeType*>& nodes = bucket->heaps[heap];
+    nodes.assign(here, right);
+    for(size_t slot = nodes.size() / 2; slot-- > 0; ){
+      siftDown(nodes, heap, slot);
+    }
+    for(size_t slot = 0; slot < nodes.size(); ++slot){
+      nodes[slot]->setSlot(heap, slot);
+    }
+  }
+  refreshBounds(bucket);
+  bucket->left = build(first, here);
+  bucket->right = build(right, last);
+  return bucket;
+}
+
+template<class Point, class Value>
+void IntervalIndex<Point, Value>::takeBuckets(Bucket* top, std::vector<NodeType*>& nodes)
+{
+  std::vector<Bucket*> stack;
+  if(top != nullptr){
+    stack.push_back(top);
+  }
+  while(!stack.empty()){
+    Bucket* bucket = stack.back();
+    stack.pop_back();
+    nodes.insert(nodes.end(), bucket->heaps[0].begin(), bucket->heaps[0].end());
+    if(bucket->left != nullptr){
+      stack.push_back(bucket->left);
+    }
+    if(bucket->right != nullptr){
+      stack.push_back(bucket->right);
+    }
+    delete bucket;
+  }
+}
+
+/**
+* Everything below a miss misses too, so every entry visited is a hit or
+* a child of one. From an entry the walk goes to its first child if it
+* is a hit, otherwise to the next sibling, climbing as far as it takes.
+*/
+template<class Point, class Value>
+template<typename Hit, typename Fn>
+void IntervalIndex<Point, Value>::report(const std::vector<NodeType*>& nodes, Hit hit, Fn& fn)
+{
+  size_t slot = 0;
+  while(slot < nodes.size()){
+    if(hit(nodes[slot])){
+      fn(nodes[slot]);
+      if(2 * slot + 1 < nodes.size()){
+        slot = 2 * slot + 1;
+        continue;
+      }
+    }
+    while(slot > 0 && (slot % 2 == 0 || slot + 1 == nodes.size())){
+      slot = (slot - 1) / 2;
+    }
+    if(slot == 0){
+      return;
+    }
+    ++slot;
+  }
+}
+
+/**
+* One root-to-leaf path. Left of a center, the intervals there that start
+* at or before point all contain it (they end after the center); right of
+* it, the ones that end after point do. The heaps hand those over at O(1)
+* per hit, so the whole query is O(depth + k).
+*/
+template<class Point, class Value>
+template<typename Fn>
+void IntervalIndex<Point, Value>::stab(const Point& point, Fn fn) const
+{
+  const Bucket* bucket = root_;
+  while(bucket != nullptr){
+    if(point < bucket->center){
+      if(!(point < bucket->firstStart)){
+        report(bucket->heaps[0], [&](const NodeType* node){ return !(point < node->getKey().start); }, fn);
+      }
+      bucket = bucket->left;
+    }
+    else{
+      if(point < bucket->lastEnd){
+        report(bucket->heaps[1], [&](const NodeType* node){ return point < node->getKey().end; }, fn);
+      }
+      bucket = bucket->right;
+    }
+  }
+}
+
+/**
+* An AVLTree of intervals keyed by start, where every node also knows
+* the largest end in its subtree (kept up to date through the rotations
+* and remove fix-ups by AugmentedAVLTree), plus an IntervalIndex of its
+* live nodes for the queries.
+*
+* Pruning the AVL walk on the max end can't answer them in O(log n + k):
+* it still has to walk down to every hit, so k hits spread out among
+* intervals that end before lo cost about k log(n / k) steps. The index
+* follows the tree on its own: nodes leave it when they are freed or
+* lazily removed, single inserts join it, and bulk changes (relayout(),
+* merge(), buildParallel(), importSorted()) leave it behind until the
+* next query rebuilds it in O(n log n). It costs two heap slots per
+* interval and a bucket per distinct center, which memoryUsage()
+* doesn't see.
+*
+* Point has to be an arithmetic type (the empty subtree uses its lowest()).
+*/
+template <class Point, class Value>
+class IntervalTree : public AugmentedAVLTree<Interval<Point>, Value, MaxEndAugment<Point, Value> >
+{
+public:
+    typedef typename BinarySearchTree<Interval<Point>, Value>::iterator iterator;
+    typedef IntervalNode<Point, Value> NodeType;
+
+    // Every stored interval that overlaps [lo, hi) (nothing if hi <= lo),
+    // in no particular order. O(log n + k) for k results: the ones that
+    // start at or before lo are a stabbing query on the index, the rest
+    // are the keys starting in (lo, hi).
+    std::vector<iterator> overlapping(const Point& lo, const Point& hi) const;
+    // Every stored interval that contains point, in no particular order.
+    // O(log n + k).
+    std::vector<iterator> stabbing(const Point& point) const;
+
+protected:
+    typedef AugmentedAVLTree<Interval<Point>, Value, MaxEndAugment<Point, Value> > Base;
+
+    virtual Node<Interval<Point>, Value>* createNode(const Interval<Point>& key, const Value& value, Node<Interval<Point>, Value>* parent);
+    virtual Node<Interval<Point>, Value>* relocateNode(const Node<Interval<Point>, Value>* node, void* where) const;
+    virtual size_t nodeSize() const;
+    virtual void refreshPath(Node<Interval<Point>, Value>* node);
+    virtual void relinkNode(Node<Interval<Point>, Value>* node, size_t leftSize, size_t rightSize, int depth);
+    // Rebuilds the index if it doesn't list exactly the live nodes
+    void syncIndex() const;
+    void collectStabbed(const Point& point, std::vector<iterator>& result) const;
+
+    mutable IntervalIndex<Point, Value> index_;
+};
+
+template<class Point, class Value>
+Node<Interval<Point>, Value>*
+IntervalTree<Point, Value>::createNode(const Interval<Point>& key, const Value& value, Node<Interval<Point>, Value>* parent)
+{
+  return new NodeType(key, value, static_cast<NodeType*>(parent), this->monoid_.lift(key, value));
+}
+
+template<class Point, class Value>
+Node<Interval<Point>, Value>*
+IntervalTree<Point, Value>::relocateNode(const Node<Interval<Point>, Value>* node, void* where) const
+{
+  return new (where) NodeType(*static_cast<const NodeType*>(node));
+}
+
+template<class Point, class Value>
+size_t IntervalTree<Point, Value>::nodeSize() const
+{
+  return sizeof(NodeType);
+}
+
+/**
+* Every single insert, revival and lazyRemove() ends up here with the
+* node that changed, which is where the index picks it up or drops it.
+*/
+template<class Point, class Value>
+void IntervalTree<Point, Value>::refreshPath(Node<Interval<Point>, Value>* node)
+{
+  NodeType* current = static_cast<NodeType*>(node);
+  if(current != nullptr && current->isTombstone() && current->getIndex() == &index_){
+    index_.remove(current);
+  }
+  else if(current != nullptr && !current->isTombstone() && current->getIndex() != &index_){
+    if(current->getIndex() != nullptr){
+      current->getIndex()->remove(current);
+    }
+    index_.insert(current);
+  }
+  Base::refreshPath(node);
+}
+
+/**
+* merge() can hand over another IntervalTree's nodes, which have to
+* leave its index. Nothing else here: buildParallel() runs this from
+* several threads at once, on fresh nodes.
+*/
+template<class Point, class Value>
+void IntervalTree<Point, Value>::relinkNode(Node<Interval<Point>, Value>* node, size_t leftSize, size_t rightSize, int depth)
+{
+  NodeType* current = static_cast<NodeType*>(node);
+  if(current->getIndex() != nullptr && current->getIndex() != &index_){
+    current->getIndex()->remove(current);
+  }
+  Base::relinkNode(node, leftSize, rightSize, depth);
+}
+
+/**
+* The index only ever lists live nodes of this tree, so it is up to
+* date exactly when it lists as many as size() says there are.
+*/
+template<class Point, class Value>
+void IntervalTree<Point, Value>::syncIndex() const
+{
+  if(index_.size() == this->size()){
+    return;
+  }
+  std::vector<NodeType*> live;
+  live.reserve(this->size());
+  std::vector<NodeType*> stack;
+  if(this->root_ != nullptr){
+    stack.push_back(static_cast<NodeType*>(this->root_));
+  }
+  while(!stack.empty()){
+    NodeType* current = stack.back();
+    stack.pop_back();
+    if(!current->isTombstone()){
+      live.push_back(current);
+    }
+    if(current->getLeft() != nullptr){
+      stack.push_back(static_cast<NodeType*>(current->getLeft()));
+    }
+    if(current->getRight() != nullptr){
+      stack.push_back(static_cast<NodeType*>(current->getRight()));
+    }
+  }
+  index_.assign(live);
+}
+
+template<class Point, class Value>
+void IntervalTree<Point, Value>::collectStabbed(const Point& point, std::vector<iterator>& result) const
+{
+  syncIndex();
+  index_.stab(point, [&](NodeType* node){
+    result.push_back(this->iteratorAt(node));
+  });
+}
+
+/**
+* An interval starting at or before lo overlaps [lo, hi) when it
+* contains lo; one starting in (lo, hi) does unless it is reversed.
+*/
+template<class Point, class Value>
+std::vector<typename IntervalTree<Point, Value>::iterator>
+IntervalTree<Point, Value>::overlapping(const Point& lo, const Point& hi) const
+{
+  std::vector<iterator> result;
+  if(!(lo < hi)){
+    return result;
+  }
+  collectStabbed(lo, result);
+
+  // First key that starts after lo
+  Node<Interval<Point>, Value>* after = nullptr;
+  Node<Interval<Point>, Value>* current = this->root_;
+  while(current != nullptr){
+    if(lo < current->getKey().start){
+      after = current;
+      current = current->getLeft();
+    }
+    else{
+      current = current->getRight();
+    }
+  }
+  for(iterator it = this->firstLive(after); it != this->end() && it->first.start < hi; ++it){
+    if(lo < it->first.end){
+      result.push_back(it);
+    }
+  }
+  return result;
+}
+
+template<class Point, class Value>
+std::vector<typename IntervalTree<Point, Value>::iterator>
+IntervalTree<Point, Value>::stabbing(const Point& point) const
+{
+  std::vector<iterator> result;
+  collectStabbed(point, result);
+  return result;
+}
+
+#endif
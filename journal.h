@@ -0,0 +1,542 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bst.h"
+
+/**
+* How the journal turns keys and values into bytes. The default copies
+* the object representation, so it only accepts trivially copyable
+* types; specialize it for anything else.
+*/
+template <typename T>
+struct JournalCodec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "JournalCodec needs a specialization for this type");
+
+    static void write(std::string& out, const T& value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    static bool read(const char*& in, const char* end, T& value)
+    {
+        if((size_t)(end - in) < sizeof(T)){
+            return false;
+        }
+        std::memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+        return true;
+    }
+};
+
+template <>
+struct JournalCodec<std::string>
+{
+    static void write(std::string& out, const std::string& value)
+    {
+        JournalCodec<uint32_t>::write(out, (uint32_t)value.size());
+        out.append(value);
+    }
+    static bool read(const char*& in, const char* end, std::string& value)
+    {
+        uint32_t length;
+        if(!JournalCodec<uint32_t>::read(in, end, length) || (size_t)(end - in) < length){
+            return false;
+        }
+        value.assign(in, length);
+        in += length;
+        return true;
+    }
+};
+
+/**
+* A write-ahead log for a tree. Updates made through insert() and
+* remove() are applied to the tree right away and their records are
+* appended to an in-memory buffer. A background thread writes the
+* buffer to the log and fsyncs it once the oldest record in it has
+* waited for the latency budget, so many updates share one fsync
+* (group commit). Each update returns a sequence number that
+* waitDurable() can block on; sync() flushes immediately.
+*
+* checkpoint() writes the whole tree to the snapshot file and empties
+* the log. Constructing a Journal loads the last snapshot (if there is
+* one) into the tree, replacing its contents, and replays the log on
+* top of it. A record cut off by a crash is dropped. Replaying a record
+* that the snapshot already contains does no harm, because every record
+* sets or removes a single key.
+*
+* insert(), remove() and checkpoint() can be called from several
+* threads: one mutex orders each tree update with its log record and
+* with the snapshot's walk over the tree. Changes made to the tree
+* directly bypass it and are not logged. Multimap trees
+* aren't supported, since replaying an insert there isn't idempotent.
+* I/O errors throw std::runtime_error (the flusher's errors are thrown
+* by the next call that touches the log).
+*/
+template <typename Key, typename Value>
+class Journal
+{
+public:
+    Journal(BinarySearchTree<Key, Value>& tree, const std::string& logPath, const std::string& snapshotPath,
+            std::chrono::microseconds latencyBudget = std::chrono::milliseconds(2));
+    ~Journal();
+
+    uint64_t insert(const std::pair<const Key, Value>& keyValuePair);
+    uint64_t remove(const Key& key);
+
+    // Blocks until every update up to sequence is on disk
+    void waitDurable(uint64_t sequence);
+    // Flushes whatever is buffered right now and waits for it
+    void sync();
+    void checkpoint();
+    // Checkpoint automatically after this many logged updates (0 = never).
+    // The update that reaches the interval runs the checkpoint itself:
+    // it writes the whole tree and waits for three fsyncs before it
+    // returns.
+    void setCheckpointInterval(size_t records);
+
+    // Log records applied when the journal was opened
+    size_t replayed() const;
+
+private:
+    enum RecordType { RECORD_INSERT = 1, RECORD_REMOVE = 2 };
+
+    uint64_t append(const std::string& body);
+    void checkpointIfDue();
+    void loadSnapshot();
+    void replayLog();
+    void flusherLoop();
+    void writeAll(int fd, const char* data, size_t size, const char* what);
+    static uint32_t checksum(const char* data, size_t size);
+
+    BinarySearchTree<Key, Value>& tree_;
+    std::string logPath_;
+    std::string snapshotPath_;
+    std::chrono::microseconds budget_;
+    int logFd_;
+    size_t replayed_;
+    // Held while tree_ is updated or walked for a snapshot; also guards
+    // the checkpoint counters
+    std::mutex treeLock_;
+    size_t checkpointInterval_;
+    size_t sinceCheckpoint_;
+
+    // Shared with the flusher
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    std::string pending_;
+    std::chrono::steady_clock::time_point oldestPending_;
+    uint64_t appended_;
+    uint64_t durable_;
+    bool flushNow_;
+    bool stopping_;
+    std::string flushError_;
+    // Held while the log file itself is written or truncated
+    std::mutex fileLock_;
+    std::thread flusher_;
+};
+
+template<typename Key, typename Value>
+Journal<Key, Value>::Journal(BinarySearchTree<Key, Value>& tree, const std::string& logPath,
+                             const std::string& snapshotPath, std::chrono::microseconds latencyBudget) :
+    tree_(tree), logPath_(logPath), snapshotPath_(snapshotPath), budget_(latencyBudget), logFd_(-1),
+    replayed_(0), checkpointInterval_(0), sinceCheckpoint_(0),
+    appended_(0), durable_(0), flushNow_(false), stopping_(false)
+{
+    if(tree_.isMultimap()){
+        throw std::invalid_argument("Journal: multimap trees are not supported");
+    }
+    loadSnapshot();
+    replayLog();
+    flusher_ = std::thread(&Journal::flusherLoop, this);
+}
+
+template<typename Key, typename Value>
+Journal<Key, Value>::~Journal()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    flusher_.join();
+    close(logFd_);
+}
+
+template<typename Key, typename Value>
+uint64_t Journal<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> guard(treeLock_);
+        tree_.insert(keyValuePair);
+        std::string body(1, (char)RECORD_INSERT);
+        JournalCodec<Key>::write(body, keyValuePair.first);
+        JournalCodec<Value>::write(body, keyValuePair.second);
+        sequence = append(body);
+    }
+    checkpointIfDue();
+    return sequence;
+}
+
+template<typename Key, typename Value>
+uint64_t Journal<Key, Value>::remove(const Key& key)
+{
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> guard(treeLock_);
+        tree_.remove(key);
+        std::string body(1, (char)RECORD_REMOVE);
+        JournalCodec<Key>::write(body, key);
+        sequence = append(body);
+    }
+    checkpointIfDue();
+    return sequence;
+}
+
+/**
+* A record on disk is its body's length and checksum followed by the
+* body, so replay can tell a complete record from a torn one. Called
+* with treeLock_ held.
+*/
+template<typename Key, typename Value>
+uint64_t Journal<Key, Value>::append(const std::string& body)
+{
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if(!flushError_.empty()){
+            throw std::runtime_error(flushError_);
+        }
+        if(pending_.empty()){
+            oldestPending_ = std::chrono::steady_clock::now();
+        }
+        JournalCodec<uint32_t>::write(pending_, (uint32_t)body.size());
+        JournalCodec<uint32_t>::write(pending_, checksum(body.data(), body.size()));
+        pending_.append(body);
+        sequence = ++appended_;
+    }
+    wake_.notify_one();
+    ++sinceCheckpoint_;
+    return sequence;
+}
+
+template<typename Key, typename Value>
+void Journal<Key, Value>::checkpointIfDue()
+{
+    bool due;
+    {
+        std::lock_guard<std::mutex> guard(treeLock_);
+        due = checkpointInterval_ != 0 && sinceCheckpoint_ >= checkpointInterval_;
+    }
+    if(due){
+        checkpoint();
+    }
+}
+
+template<typename Key, typename Value>
+void Journal<Key, Value>::waitDurable(uint64_t sequence)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while(durable_ < sequence && flushError_.empty()){
+        flushed_.wait(guard);
+    }
+    if(!flushError_.empty()){
+        throw std::runtime_error(flushError_);
+    }
+}
+
+template<typename Key, typename Value>
+void Journal<Key, Value>::sync()
+{
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        sequence = appended_;
+        flushNow_ = true;
+    }
+    wake_.notify_one();
+    waitDurable(sequence);
+}
+
+/**
+* fsyncs the directory holding path, so a rename into it is on disk.
+*/
+inline void journalSyncDirectory(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if(fd < 0){
+        throw std::runtime_error("Journal: cannot open " + directory);
+    }
+    int result = fsync(fd);
+    close(fd);
+    if(result != 0){
+        throw std::runtime_error("Journal: cannot sync " + directory);
+    }
+}
+
+/**
+* The snapshot is written to a temporary file and renamed over the old
+* one, so a crash leaves either the old or the new snapshot. The log is
+* only truncated once the rename itself is durable, so a crash can't
+* keep the truncation but lose the new snapshot. Writers only wait
+* while the tree is copied out; records they add after that reach the
+* log after the truncation.
+*/
+template<typename Key, typename Value>
+void Journal<Key, Value>::checkpoint()
+{
+    sync();
+    std::lock_guard<std::mutex> guard(fileLock_);
+
+    std::string data;
+    {
+        std::lock_guard<std::mutex> tree(treeLock_);
+        JournalCodec<uint64_t>::write(data, (uint64_t)tree_.size());
+        for(typename BinarySearchTree<Key, Value>::iterator it = tree_.begin(); it != tree_.end(); ++it){
+            JournalCodec<Key>::write(data, it->first);
+            JournalCodec<Value>::write(data, it->second);
+        }
+        sinceCheckpoint_ = 0;
+    }
+    JournalCodec<uint32_t>::write(data, checksum(data.data(), data.size()));
+
+    std::string tempPath = snapshotPath_ + ".tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        throw std::runtime_error("Journal: cannot create " + tempPath);
+    }
+    writeAll(fd, data.data(), data.size(), "snapshot");
+    if(fsync(fd) != 0 || close(fd) != 0){
+        throw std::runtime_error("Journal: cannot sync " + tempPath);
+    }
+    if(rename(tempPath.c_str(), snapshotPath_.c_str()) != 0){
+        throw std::runtime_error("Journal: cannot rename " + tempPath);
+    }
+    journalSyncDirectory(snapshotPath_);
+    if(ftruncate(logFd_, 0) != 0 || fsync(logFd_) != 0){
+        throw std::runtime_error("Journal: cannot truncate " + logPath_);
+    }
+}
+
+template<typename Key, typename Value>
+void Journal<Key, Value>::setCheckpointInterval(size_t records)
+{
+    std::lock_guard<std::mutex> guard(treeLock_);
+    checkpointInterval_ = records;
+}
+
+template<typename Key, typename Value>
+size_t Journal<Key, Value>::replayed() const
+{
+    return replayed_;
+}
+
+/**
+* Reads a whole file; a missing file reads as empty.
+*/
+inline std::string journalReadFile(const std::string& path)
+{
+    std::string data;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        if(errno == ENOENT){
+            return data;
+        }
+        throw std::runtime_error("Journal: cannot open " + path);
+    }
+    char buffer[65536];
+    ssize_t got;
+    while((got = read(fd, buffer, sizeof(buffer))) > 0){
+        data.append(buffer, got);
+    }
+    close(fd);
+    if(got < 0){
+        throw std::runtime_error("Journal: cannot read " + path);
+    }
+    return data;
+}
+
+/**
+* The snapshot is in key order, so it goes straight into importSorted().
+* A snapshot that fails its checksum can't have been renamed into place
+* by checkpoint(), so that is reported rather than silently ignored.
+*/
+template<typename Key, typename Value>
+void Journal<Key, Value>::loadSnapshot()
+{
+    std::string data = journalReadFile(snapshotPath_);
+    if(data.empty()){
+        return;
+    }
+    if(data.size() < sizeof(uint64_t) + sizeof(uint32_t)){
+        throw std::runtime_error("Journal: corrupt snapshot " + snapshotPath_);
+    }
+
+    // The checksum covers everything in front of it
+    const char* in = data.data();
+    const char* end = in + data.size() - sizeof(uint32_t);
+    const char* tail = end;
+    uint32_t expected;
+    uint64_t count;
+    JournalCodec<uint32_t>::read(tail, tail + sizeof(uint32_t), expected);
+    if(checksum(in, end - in) != expected || !JournalCodec<uint64_t>::read(in, end, count)){
+        throw std::runtime_error("Journal: corrupt snapshot " + snapshotPath_);
+    }
+
+    std::vector<std::pair<Key, Value> > items(count);
+    for(uint64_t i = 0; i < count; ++i){
+        if(!JournalCodec<Key>::read(in, end, items[i].first) || !JournalCodec<Value>::read(in, end, items[i].second)){
+            throw std::runtime_error("Journal: corrupt snapshot " + snapshotPath_);
+        }
+    }
+    tree_.importSorted(items.empty() ? nullptr : &items[0], items.size());
+}
+
+/**
+* Applies every complete record, then cuts the log off after the last
+* one so new records don't end up behind a torn one.
+*/
+template<typename Key, typename Value>
+void Journal<Key, Value>::replayLog()
+{
+    std::string data = journalReadFile(logPath_);
+    const char* in = data.data();
+    const char* end = in + data.size();
+    while(true){
+        const char* record = in;
+        uint32_t length;
+        uint32_t expected;
+        if(!JournalCodec<uint32_t>::read(in, end, length) || !JournalCodec<uint32_t>::read(in, end, expected)
+           || (size_t)(end - in) < length || length == 0 || checksum(in, length) != expected){
+            in = record;
+            break;
+        }
+
+        const char* body = in + 1;
+        const char* bodyEnd = in + length;
+        Key key;
+        Value value;
+        bool ok = JournalCodec<Key>::read(body, bodyEnd, key);
+        if(ok && *in == RECORD_INSERT && JournalCodec<Value>::read(body, bodyEnd, value)){
+            tree_.insert(std::make_pair(key, value));
+        }
+        else if(ok && *in == RECORD_REMOVE){
+            tree_.remove(key);
+        }
+        else{
+            in = record;
+            break;
+        }
+        in = bodyEnd;
+        ++replayed_;
+    }
+
+    logFd_ = open(logPath_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(logFd_ < 0){
+        throw std::runtime_error("Journal: cannot open " + logPath_);
+    }
+    if(in != end && (ftruncate(logFd_, in - data.data()) != 0 || fsync(logFd_) != 0)){
+        close(logFd_);
+        throw std::runtime_error("Journal: cannot truncate " + logPath_);
+    }
+}
+
+/**
+* Sleeps until the oldest buffered record has used up the latency
+* budget (or sync() asks), then writes and fsyncs everything buffered
+* so far in one go. Records appended meanwhile wait for the next round.
+*/
+template<typename Key, typename Value>
+void Journal<Key, Value>::flusherLoop()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while(true){
+        while(!stopping_ && !flushNow_ && (pending_.empty() || std::chrono::steady_clock::now() < oldestPending_ + budget_)){
+            if(pending_.empty()){
+                wake_.wait(guard);
+            }
+            else{
+                wake_.wait_until(guard, oldestPending_ + budget_);
+            }
+        }
+        if(stopping_ && pending_.empty()){
+            return;
+        }
+
+        std::string batch;
+        batch.swap(pending_);
+        uint64_t sequence = appended_;
+        flushNow_ = false;
+        guard.unlock();
+
+        std::string error;
+        try{
+            std::lock_guard<std::mutex> file(fileLock_);
+            writeAll(logFd_, batch.data(), batch.size(), "log");
+            if(fdatasync(logFd_) != 0){
+                throw std::runtime_error("Journal: cannot sync " + logPath_);
+            }
+        }
+        catch(std::runtime_error& e){
+            error = e.what();
+        }
+
+        guard.lock();
+        if(error.empty()){
+            durable_ = sequence;
+        }
+        else{
+            flushError_ = error;
+        }
+        flushed_.notify_all();
+    }
+}
+
+template<typename Key, typename Value>
+void Journal<Key, Value>::writeAll(int fd, const char* data, size_t size, const char* what)
+{
+    while(size > 0){
+        ssize_t written = write(fd, data, size);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            throw std::runtime_error(std::string("Journal: cannot write ") + what);
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+/**
+* FNV-1a; enough to tell a torn record from a complete one.
+*/
+template<typename Key, typename Value>
+uint32_t Journal<Key, Value>::checksum(const char* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; ++i){
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+#endif
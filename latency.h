@@ -0,0 +1,235 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+/**
+* Latency histograms for tree operations. Timestamps come from the
+* cheapest counter the CPU has; they are only turned into nanoseconds
+* when a histogram is read, with a rate measured once against
+* steady_clock.
+*/
+
+// Raw timestamp: the TSC on x86 (constant rate on anything recent), the
+// virtual counter on AArch64, steady_clock nanoseconds elsewhere
+inline uint64_t latencyTicks()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+* Nanoseconds per tick. The first call spins for about 10ms comparing
+* the counter with steady_clock; later ones return the cached rate.
+*/
+inline double latencyNsPerTick()
+{
+    static const double nsPerTick = []() -> double {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t first = latencyTicks();
+        std::chrono::steady_clock::time_point now = start;
+        while(now - start < std::chrono::milliseconds(10)){
+            now = std::chrono::steady_clock::now();
+        }
+        uint64_t ticks = latencyTicks() - first;
+        double ns = std::chrono::duration<double, std::nano>(now - start).count();
+        return ticks == 0 ? 1.0 : ns / ticks;
+    }();
+    return nsPerTick;
+}
+
+/**
+* HDR-style histogram of tick counts: exact below 64, above that 32
+* buckets per power of two, so any value is off by 1/32 (about 3%) at
+* most. Covers the whole uint64_t range in 1920 buckets, allocated on
+* the first record().
+*/
+class LatencyHistogram
+{
+public:
+    enum { SUB_BITS = 5, BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS };
+
+    LatencyHistogram() : count_(0), sum_(0), min_(UINT64_MAX), max_(0) { }
+
+    void record(uint64_t ticks)
+    {
+        if(counts_.empty()){
+            counts_.assign(BUCKETS, 0);
+        }
+        ++counts_[bucket(ticks)];
+        ++count_;
+        sum_ += ticks;
+        min_ = std::min(min_, ticks);
+        max_ = std::max(max_, ticks);
+    }
+
+    // Adds other's samples, e.g. to combine per-thread histograms
+    void merge(const LatencyHistogram& other)
+    {
+        if(other.count_ == 0){
+            return;
+        }
+        if(counts_.empty()){
+            counts_.assign(BUCKETS, 0);
+        }
+        for(size_t i = 0; i < counts_.size(); ++i){
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset() { *this = LatencyHistogram(); }
+
+    uint64_t count() const { return count_; }
+    // The rest are in nanoseconds, 0 for an empty histogram
+    double min() const { return count_ == 0 ? 0.0 : min_ * latencyNsPerTick(); }
+    double max() const { return max_ * latencyNsPerTick(); }
+    double mean() const { return count_ == 0 ? 0.0 : (double)sum_ / count_ * latencyNsPerTick(); }
+
+    // Smallest value that at least percent % of the samples are no
+    // bigger than (the top of its bucket, but never past max())
+    double percentile(double percent) const
+    {
+        if(count_ == 0){
+            return 0.0;
+        }
+        // The epsilon stops float error (99.9% of 1000 is 999.0000001)
+        // from pushing the rank up by one
+        uint64_t rank = (uint64_t)std::ceil(percent / 100.0 * count_ - 1e-9);
+        rank = std::max((uint64_t)1, std::min(rank, count_));
+        uint64_t seen = 0;
+        size_t i = 0;
+        while(seen + counts_[i] < rank){
+            seen += counts_[i++];
+        }
+        return std::min(bucketTop(i), max_) * latencyNsPerTick();
+    }
+
+    // Heap bytes held by the buckets
+    size_t bytes() const { return counts_.capacity() * sizeof(uint64_t); }
+
+    static size_t bucket(uint64_t ticks)
+    {
+        int shift = 0;
+        if(ticks >= (2u << SUB_BITS)){
+            shift = 63 - __builtin_clzll(ticks) - SUB_BITS;
+        }
+        return ((size_t)shift << SUB_BITS) + (size_t)(ticks >> shift);
+    }
+
+    // Largest tick count that falls in bucket i
+    static uint64_t bucketTop(size_t i)
+    {
+        if(i < (2u << SUB_BITS)){
+            return i;
+        }
+        int shift = (int)(i >> SUB_BITS) - 1;
+        uint64_t mantissa = i - ((uint64_t)shift << SUB_BITS);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+/**
+* What the trees time. LATENCY_STEP is an iterator or cursor moving to
+* the next item.
+*/
+enum LatencyOp { LATENCY_FIND, LATENCY_INSERT, LATENCY_REMOVE, LATENCY_STEP, LATENCY_OPS };
+
+inline const char* latencyOpName(int op)
+{
+    static const char* names[LATENCY_OPS] = { "find", "insert", "remove", "step" };
+    return names[op];
+}
+
+/**
+* One histogram per LatencyOp, with text and JSON dumps of the usual
+* percentiles (all in nanoseconds).
+*/
+struct LatencyStats
+{
+    LatencyHistogram ops[LATENCY_OPS];
+
+    void merge(const LatencyStats& other)
+    {
+        for(int op = 0; op < LATENCY_OPS; ++op){
+            ops[op].merge(other.ops[op]);
+        }
+    }
+
+    // One line per operation that has samples
+    void writeText(std::ostream& os) const
+    {
+        for(int op = 0; op < LATENCY_OPS; ++op){
+            const LatencyHistogram& h = ops[op];
+            if(h.count() == 0){
+                continue;
+            }
+            os << latencyOpName(op) << ": count " << h.count() << ", mean " << (uint64_t)h.mean()
+               << "ns, p50 " << (uint64_t)h.percentile(50) << "ns, p99 " << (uint64_t)h.percentile(99)
+               << "ns, p999 " << (uint64_t)h.percentile(99.9) << "ns, max " << (uint64_t)h.max() << "ns\n";
+        }
+    }
+
+    // {"find": {"count": ..., "min_ns": ..., ...}, ...}, every operation
+    void writeJson(std::ostream& os) const
+    {
+        os << '{';
+        for(int op = 0; op < LATENCY_OPS; ++op){
+            const LatencyHistogram& h = ops[op];
+            os << (op > 0 ? ", \"" : "\"") << latencyOpName(op) << "\": {\"count\": " << h.count()
+               << ", \"min_ns\": " << (uint64_t)h.min() << ", \"mean_ns\": " << (uint64_t)h.mean()
+               << ", \"p50_ns\": " << (uint64_t)h.percentile(50) << ", \"p99_ns\": " << (uint64_t)h.percentile(99)
+               << ", \"p999_ns\": " << (uint64_t)h.percentile(99.9) << ", \"max_ns\": " << (uint64_t)h.max() << '}';
+        }
+        os << "}\n";
+    }
+};
+
+/**
+* Times its own lifetime into histogram, or does nothing if that is
+* nullptr (so a disabled tree pays one pointer test).
+*/
+class LatencyTimer
+{
+public:
+    explicit LatencyTimer(LatencyHistogram* histogram) :
+        histogram_(histogram), start_(histogram != nullptr ? latencyTicks() : 0) { }
+    ~LatencyTimer()
+    {
+        if(histogram_ != nullptr){
+            histogram_->record(latencyTicks() - start_);
+        }
+    }
+
+private:
+    LatencyTimer(const LatencyTimer&);
+    LatencyTimer& operator=(const LatencyTimer&);
+
+    LatencyHistogram* histogram_;
+    uint64_t start_;
+};
+
+#endif
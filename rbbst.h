@@ -0,0 +1,448 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include "bst.h"
+
+enum RBColor { RB_RED, RB_BLACK };
+
+/**
+* A node for a red-black tree, which adds the color as a data member.
+* Missing (nullptr) children count as black.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    // Constructor/destructor. New nodes start out red.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    virtual ~RBNode();
+
+    // Getter/setter for the node's color.
+    RBColor getColor() const;
+    void setColor(RBColor color);
+
+    // Getters for parent, left, and right, redefined to return RBNodes
+    // the same way AVLNode does.
+    virtual RBNode<Key, Value>* getParent() const override;
+    virtual RBNode<Key, Value>* getLeft() const override;
+    virtual RBNode<Key, Value>* getRight() const override;
+
+protected:
+    RBColor color_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor to initialize the elements by calling the base class constructor
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(key, value, parent), color_(RB_RED)
+{
+
+}
+
+/**
+* A destructor which does nothing.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::~RBNode()
+{
+
+}
+
+/**
+* A getter for the color of a RBNode.
+*/
+template<class Key, class Value>
+RBColor RBNode<Key, Value>::getColor() const
+{
+    return color_;
+}
+
+/**
+* A setter for the color of a RBNode.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setColor(RBColor color)
+{
+    color_ = color;
+}
+
+/**
+* An overridden function for getting the parent since a static_cast is necessary to make sure
+* that our node is a RBNode.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->children_[0]);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->children_[1]);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* A red-black tree. Reads are a little slower than AVLTree since the
+* tree can be up to 2log(n) deep, but every insert or remove does at
+* most three rotations, which makes it the cheaper choice for
+* write-heavy (especially remove-heavy) maps.
+*/
+template <class Key, class Value>
+class RedBlackTree : public BinarySearchTree<Key, Value>
+{
+public:
+    // insert() and remove() come from BinarySearchTree; the recoloring is
+    // in rebalanceInsert() and removeNode()
+
+    // Checks the red-black invariants: black root, no red node with a
+    // red child, the same number of black nodes on every path down to a
+    // null child, and parent links that match the child links. (The
+    // inherited isBalanced() checks the stricter AVL rule, which a valid
+    // red-black tree need not meet.)
+    bool isValid() const;
+protected:
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual void relinkNode(Node<Key, Value>* node, size_t leftSize, size_t rightSize, int depth);
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual Node<Key, Value>* relocateNode(const Node<Key, Value>* node, void* where) const;
+    virtual void rebalanceInsert(Node<Key, Value>* newNode);
+    virtual void nodeSwap( RBNode<Key,Value>* n1, RBNode<Key,Value>* n2);
+    void insertFix(RBNode<Key, Value>* node);
+    void removeFix(RBNode<Key, Value>* node, RBNode<Key, Value>* parent);
+    static bool isRed(RBNode<Key, Value>* node);
+    virtual void describeNode(const Node<Key, Value>* node, ExportFields& fields) const;
+    virtual size_t nodeSize() const;
+
+};
+
+/**
+* Null children are black, so this is safe to call on any child pointer.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isRed(RBNode<Key, Value>* node)
+{
+  return node != nullptr && node->getColor() == RB_RED;
+}
+
+/**
+* Walks the tree with an explicit stack, carrying each node's count of
+* black nodes from the root, so a broken tree can't send it in circles.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isValid() const
+{
+  RBNode<Key, Value>* root = static_cast<RBNode<Key, Value>*>(this->root_);
+  if(root == nullptr){
+    return true;
+  }
+  if(isRed(root) || root->getParent() != nullptr){
+    return false;
+  }
+
+  // Black height of the first path to a null child; -1 until one is seen
+  int blackHeight = -1;
+  std::vector<std::pair<RBNode<Key, Value>*, int> > stack;
+  stack.push_back(std::make_pair(root, 1));
+  while(!stack.empty()){
+    RBNode<Key, Value>* node = stack.back().first;
+    int blacks = stack.back().second;
+    stack.pop_back();
+
+    RBNode<Key, Value>* children[2] = { node->getLeft(), node->getRight() };
+    for(int i = 0; i < 2; ++i){
+      RBNode<Key, Value>* child = children[i];
+      if(child == nullptr){
+        if(blackHeight < 0){
+          blackHeight = blacks;
+        }
+        else if(blacks != blackHeight){
+          return false;
+        }
+        continue;
+      }
+      if(child->getParent() != node || (isRed(node) && isRed(child))){
+        return false;
+      }
+      stack.push_back(std::make_pair(child, blacks + (isRed(child) ? 0 : 1)));
+    }
+  }
+  return true;
+}
+
+template<class Key, class Value>
+size_t RedBlackTree<Key, Value>::nodeSize() const
+{
+  return sizeof(RBNode<Key, Value>);
+}
+
+/**
+* Exporters show each node's color.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::describeNode(const Node<Key, Value>* node, ExportFields& fields) const
+{
+  BinarySearchTree<Key, Value>::describeNode(node, fields);
+  RBColor color = static_cast<const RBNode<Key, Value>*>(node)->getColor();
+  fields.push_back(ExportField("color", color == RB_RED ? "red" : "black", false));
+}
+
+// HELPER FUNCTIONS FOR INSERT
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insertFix(RBNode<Key, Value>* node)
+{
+  // Only a red node with a red parent breaks the invariants
+  while(isRed(node->getParent())){
+    RBNode<Key, Value>* parent = node->getParent();
+    // The parent is red, so it can't be the root and grandparent exists
+    RBNode<Key, Value>* grandparent = parent->getParent();
+
+    if(parent == grandparent->getLeft()){
+      RBNode<Key, Value>* uncle = grandparent->getRight();
+
+      // Case 1: red uncle -> recolor and continue from the grandparent
+      if(isRed(uncle)){
+        parent->setColor(RB_BLACK);
+        uncle->setColor(RB_BLACK);
+        grandparent->setColor(RB_RED);
+        node = grandparent;
+        continue;
+      }
+      // Case 2: node is an inner child -> rotate it to the outside
+      if(node == parent->getRight()){
+        this->rotateLeft(parent);
+        node = parent;
+        parent = node->getParent();
+      }
+      // Case 3: outer child -> one rotation at the grandparent finishes
+      parent->setColor(RB_BLACK);
+      grandparent->setColor(RB_RED);
+      this->rotateRight(grandparent);
+    }
+    else{
+      RBNode<Key, Value>* uncle = grandparent->getLeft();
+
+      if(isRed(uncle)){
+        parent->setColor(RB_BLACK);
+        uncle->setColor(RB_BLACK);
+        grandparent->setColor(RB_RED);
+        node = grandparent;
+        continue;
+      }
+      if(node == parent->getLeft()){
+        this->rotateRight(parent);
+        node = parent;
+        parent = node->getParent();
+      }
+      parent->setColor(RB_BLACK);
+      grandparent->setColor(RB_RED);
+      this->rotateLeft(grandparent);
+    }
+  }
+
+  static_cast<RBNode<Key, Value>*>(this->root_)->setColor(RB_BLACK);
+}
+
+
+/**
+* Node factory for BinarySearchTree::insert, so every node in the tree
+* is an RBNode. New nodes start out red.
+*/
+template<class Key, class Value>
+Node<Key, Value>* RedBlackTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+  return new RBNode<Key, Value>(key, value, static_cast<RBNode<Key, Value>*>(parent));
+}
+
+template<class Key, class Value>
+Node<Key, Value>* RedBlackTree<Key, Value>::relocateNode(const Node<Key, Value>* node, void* where) const
+{
+  return new (where) RBNode<Key, Value>(*static_cast<const RBNode<Key, Value>*>(node));
+}
+
+/*
+ * Called by BinarySearchTree::insert once the new red leaf is linked in.
+ */
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rebalanceInsert(Node<Key, Value>* newNode)
+{
+  insertFix(static_cast<RBNode<Key, Value>*>(newNode));
+}
+
+/**
+* compact() and buildParallel() build a size-balanced tree: every null
+* child sits at depth floor(log2(n+1)) or one below it. Everything above
+* that level is black and the partial last level is red, which gives
+* every path the same number of black nodes.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::relinkNode(Node<Key, Value>* node, size_t leftSize, size_t rightSize, int depth)
+{
+  int fullLevels = 0;
+  for(size_t n = this->nodeCount_ + 1; n > 1; n /= 2){
+    ++fullLevels;
+  }
+  static_cast<RBNode<Key, Value>*>(node)->setColor(depth >= fullLevels ? RB_RED : RB_BLACK);
+}
+
+// HELPER FUNCTIONS FOR REMOVE
+/**
+* Restores the black height after a black node was unlinked. node is
+* the child that took its place (possibly nullptr, hence the separate
+* parent argument) and carries an "extra" black.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::removeFix(RBNode<Key, Value>* node, RBNode<Key, Value>* parent)
+{
+  while(node != this->root_ && !isRed(node)){
+    if(node == parent->getLeft()){
+      RBNode<Key, Value>* sibling = parent->getRight();
+
+      // Case 1: red sibling -> rotate so the sibling becomes black
+      if(isRed(sibling)){
+        sibling->setColor(RB_BLACK);
+        parent->setColor(RB_RED);
+        this->rotateLeft(parent);
+        sibling = parent->getRight();
+      }
+      // Case 2: sibling has no red children -> push the extra black up
+      if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+        sibling->setColor(RB_RED);
+        node = parent;
+        parent = node->getParent();
+        continue;
+      }
+      // Case 3: only the inner nephew is red -> make it the outer one
+      if(!isRed(sibling->getRight())){
+        sibling->getLeft()->setColor(RB_BLACK);
+        sibling->setColor(RB_RED);
+        this->rotateRight(sibling);
+        sibling = parent->getRight();
+      }
+      // Case 4: outer nephew is red -> one rotation finishes
+      sibling->setColor(parent->getColor());
+      parent->setColor(RB_BLACK);
+      sibling->getRight()->setColor(RB_BLACK);
+      this->rotateLeft(parent);
+      node = static_cast<RBNode<Key, Value>*>(this->root_);
+    }
+    else{
+      RBNode<Key, Value>* sibling = parent->getLeft();
+
+      if(isRed(sibling)){
+        sibling->setColor(RB_BLACK);
+        parent->setColor(RB_RED);
+        this->rotateRight(parent);
+        sibling = parent->getLeft();
+      }
+      if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+        sibling->setColor(RB_RED);
+        node = parent;
+        parent = node->getParent();
+        continue;
+      }
+      if(!isRed(sibling->getLeft())){
+        sibling->getRight()->setColor(RB_BLACK);
+        sibling->setColor(RB_RED);
+        this->rotateLeft(sibling);
+        sibling = parent->getLeft();
+      }
+      sibling->setColor(parent->getColor());
+      parent->setColor(RB_BLACK);
+      sibling->getLeft()->setColor(RB_BLACK);
+      this->rotateRight(parent);
+      node = static_cast<RBNode<Key, Value>*>(this->root_);
+    }
+  }
+
+  if(node != nullptr){
+    node->setColor(RB_BLACK);
+  }
+}
+
+/*
+ * Recall: The writeup specifies that if a node has 2 children you
+ * should swap with the predecessor and then remove.
+ */
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::removeNode(Node<Key, Value>* node)
+{
+  RBNode<Key, Value>* current = static_cast<RBNode<Key, Value>*>(node);
+
+  // Two children: swap with the predecessor (colors travel with the
+  // positions) so current has at most one child
+  if(current->getLeft() != nullptr && current->getRight() != nullptr){
+    RBNode<Key, Value>* pred = static_cast<RBNode<Key, Value>*>(this->predecessor(current));
+    nodeSwap(current, pred);
+  }
+
+  RBNode<Key, Value>* child = current->getLeft();
+  if(child == nullptr){
+    child = current->getRight();
+  }
+  RBNode<Key, Value>* parent = current->getParent();
+
+  if(child != nullptr){
+    child->setParent(parent);
+  }
+
+  if(parent == nullptr){
+    this->root_ = child;
+  }
+  else if(parent->getLeft() == current){
+    parent->setLeft(child);
+  }
+  else{
+    parent->setRight(child);
+  }
+
+  // Removing a red node never changes a black height
+  bool removedBlack = !isRed(current);
+  this->destroyNode(current);
+
+  if(removedBlack){
+    removeFix(child, parent);
+  }
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::nodeSwap( RBNode<Key,Value>* n1, RBNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    RBColor tempC = n1->getColor();
+    n1->setColor(n2->getColor());
+    n2->setColor(tempC);
+}
+
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include "bst.h"
+
+/**
+* A self-adjusting search tree. Every access (find, insert, operator[])
+* rotates the touched node up to the root, so keys that are looked up
+* often stay near the top. Nothing extra is stored per node, so it uses
+* the plain Node from bst.h.
+*
+* Note: splaying changes the shape of the tree, so find() and operator[]
+* only splay on non-const trees. The const overloads behave like the
+* ones in BinarySearchTree.
+*/
+template <class Key, class Value>
+class SplayTree : public BinarySearchTree<Key, Value>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+    using BinarySearchTree<Key, Value>::insert;
+    using BinarySearchTree<Key, Value>::find;
+
+    virtual void insert (const std::pair<const Key, Value> &new_item);
+    virtual void remove(const Key& key);
+
+    iterator find(const Key& key);
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    virtual void rebalanceInsert(Node<Key, Value>* newNode);
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual void accessNode(Node<Key, Value>* node);
+    void splay(Node<Key, Value>* current);
+    Node<Key, Value>* splaySearch(const Key& key);
+    Node<Key, Value>* splayFind(const Key& key);
+};
+
+/**
+* Moves current to the root with zig, zig-zig and zig-zag steps.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::splay(Node<Key, Value>* current)
+{
+  if(current == nullptr){
+    return;
+  }
+
+  while(current->getParent() != nullptr){
+    Node<Key, Value>* parent = current->getParent();
+    Node<Key, Value>* grandparent = parent->getParent();
+    bool currentIsLeft = (parent->getLeft() == current);
+
+    // Zig: parent is the root, one rotation finishes
+    if(grandparent == nullptr){
+      if(currentIsLeft){
+        this->rotateRight(parent);
+      }
+      else{
+        this->rotateLeft(parent);
+      }
+    }
+    // Zig-zig: rotate the grandparent first, then the parent
+    else if(currentIsLeft == (grandparent->getLeft() == parent)){
+      if(currentIsLeft){
+        this->rotateRight(grandparent);
+        this->rotateRight(parent);
+      }
+      else{
+        this->rotateLeft(grandparent);
+        this->rotateLeft(parent);
+      }
+    }
+    // Zig-zag: rotate current up twice
+    else{
+      if(currentIsLeft){
+        this->rotateRight(parent);
+        this->rotateLeft(grandparent);
+      }
+      else{
+        this->rotateLeft(parent);
+        this->rotateRight(grandparent);
+      }
+    }
+  }
+}
+
+/**
+* Looks for key and splays whatever node the search ended on, so that
+* misses also pay for themselves. Returns the node with key (which may
+* be a tombstone) or nullptr.
+*/
+template<class Key, class Value>
+Node<Key, Value>* SplayTree<Key, Value>::splaySearch(const Key& key)
+{
+  Node<Key, Value>* current = this->root_;
+  Node<Key, Value>* last = nullptr;
+
+  while(current != nullptr){
+    last = current;
+    if(key < current->getKey()){
+      current = current->getLeft();
+    }
+    else if(key > current->getKey()){
+      current = current->getRight();
+    }
+    else{
+      break;
+    }
+  }
+
+  splay(last);
+  return current;
+}
+
+/**
+* splaySearch() for lookups: lazily removed keys count as misses.
+*/
+template<class Key, class Value>
+Node<Key, Value>* SplayTree<Key, Value>::splayFind(const Key& key)
+{
+  Node<Key, Value>* current = splaySearch(key);
+  // A multimap may still have a live copy elsewhere
+  if(current != nullptr && current->isTombstone()){
+    current = this->internalFind(key);
+  }
+  return current;
+}
+
+template<class Key, class Value>
+typename SplayTree<Key, Value>::iterator
+SplayTree<Key, Value>::find(const Key& key)
+{
+  LatencyTimer timer(this->latencyFor(LATENCY_FIND));
+  return this->withStepLatency(this->iteratorAt(splayFind(key)));
+}
+
+template<class Key, class Value>
+typename SplayTree<Key, Value>::iterator
+SplayTree<Key, Value>::find(const Key& key) const
+{
+  return BinarySearchTree<Key, Value>::find(key);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& SplayTree<Key, Value>::operator[](const Key& key)
+{
+  LatencyTimer timer(this->latencyFor(LATENCY_FIND));
+  Node<Key, Value>* curr = splayFind(key);
+  if(curr == nullptr) throw std::out_of_range("Invalid key");
+  return curr->getValue();
+}
+
+template<class Key, class Value>
+Value const & SplayTree<Key, Value>::operator[](const Key& key) const
+{
+  return BinarySearchTree<Key, Value>::operator[](key);
+}
+
+/*
+ * Same overwrite semantics as BinarySearchTree::insert, but the new
+ * (or updated) node ends up at the root.
+ */
+template<class Key, class Value>
+void SplayTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+{
+  LatencyTimer timer(this->latencyFor(LATENCY_INSERT));
+  Node<Key, Value>* current = this->root_;
+  Node<Key, Value>* parent = nullptr;
+
+  while(current != nullptr){
+    parent = current;
+    if(new_item.first < current->getKey()){
+      current = current->getLeft();
+    }
+    else if(new_item.first > current->getKey() || this->multimap_){
+      current = current->getRight();
+    }
+    // Key already exists -> overwrite value and splay it
+    else{
+      this->overwriteNode(current, new_item.second);
+      splay(current);
+      return;
+    }
+  }
+
+  // The new node gets splayed by rebalanceInsert()
+  this->attachNode(parent, new_item);
+}
+
+/**
+* New nodes (including ones added through the hinted insert) go to the root.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::rebalanceInsert(Node<Key, Value>* newNode)
+{
+  splay(newNode);
+}
+
+/**
+* getOrInsert() and upsert() hits splay like any other access.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::accessNode(Node<Key, Value>* node)
+{
+  splay(node);
+}
+
+/*
+ * The search splays, so a miss still splays the last node it saw and a
+ * hit brings the node to the root before removeNode() unlinks it. Like
+ * BinarySearchTree::remove, a tombstone with the key is removed too.
+ */
+template<class Key, class Value>
+void SplayTree<Key, Value>::remove(const Key& key)
+{
+  LatencyTimer timer(this->latencyFor(LATENCY_REMOVE));
+  Node<Key, Value>* current = splaySearch(key);
+  while(current != nullptr){
+    removeNode(current);
+    if(!this->multimap_){
+      return;
+    }
+    current = splaySearch(key);
+  }
+}
+
+/*
+ * Removes the node the same way BinarySearchTree does (swap with the
+ * predecessor when there are two children) and then splays the parent
+ * of the node that was unlinked.
+ */
+template<class Key, class Value>
+void SplayTree<Key, Value>::removeNode(Node<Key, Value>* current)
+{
+  // Two children: swap with the predecessor so current has at most one
+  if(current->getLeft() != nullptr && current->getRight() != nullptr){
+    this->nodeSwap(current, this->predecessor(current));
+  }
+
+  Node<Key, Value>* child = current->getLeft();
+  if(child == nullptr){
+    child = current->getRight();
+  }
+  Node<Key, Value>* parent = current->getParent();
+
+  if(child != nullptr){
+    child->setParent(parent);
+  }
+
+  if(parent == nullptr){
+    this->root_ = child;
+  }
+  else if(parent->getLeft() == current){
+    parent->setLeft(child);
+  }
+  else{
+    parent->setRight(child);
+  }
+
+  this->destroyNode(current);
+  splay(parent);
+}
+
+#endif
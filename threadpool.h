@@ -0,0 +1,204 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+
+/**
+* A fixed set of worker threads that runs one parallelFor() at a time.
+* Each worker starts with a contiguous block of task indices in its own
+* deque and works through it front to back. Once that runs dry it
+* steals from the back of another worker's deque. The calling thread
+* joins in as worker 0.
+*
+* Tasks must not throw or call parallelFor() on the same pool.
+*/
+class WorkStealingPool
+{
+public:
+    // threads == 0 means one worker per hardware thread
+    explicit WorkStealingPool(size_t threads = 0);
+    ~WorkStealingPool();
+
+    size_t size() const;
+
+    // Runs task(i) for every i in [0, count) and returns once all of
+    // them have finished
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+    // Pool shared by everything that doesn't pass its own
+    static WorkStealingPool& shared();
+
+private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    void workerLoop(size_t worker);
+    void runTasks(size_t worker);
+    bool popTask(size_t worker, size_t& task);
+    bool stealTask(size_t worker, size_t& task);
+
+    std::vector<std::thread> threads_;
+    std::vector<WorkQueue> queues_;
+
+    // The job being run and the generation that announces it
+    std::mutex jobLock_;
+    std::condition_variable jobStart_;
+    std::condition_variable jobDone_;
+    const std::function<void(size_t)>* task_;
+    size_t generation_;
+    size_t remaining_;
+    size_t busyWorkers_;
+    bool stopping_;
+
+    // Only one parallelFor() at a time
+    std::mutex runLock_;
+};
+
+inline WorkStealingPool::WorkStealingPool(size_t threads) :
+    queues_(threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threads),
+    task_(nullptr), generation_(0), remaining_(0), busyWorkers_(0), stopping_(false)
+{
+    // Worker 0 is whoever calls parallelFor()
+    for(size_t i = 1; i < queues_.size(); ++i){
+        threads_.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+}
+
+inline WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(jobLock_);
+        stopping_ = true;
+    }
+    jobStart_.notify_all();
+    for(size_t i = 0; i < threads_.size(); ++i){
+        threads_[i].join();
+    }
+}
+
+inline size_t WorkStealingPool::size() const
+{
+    return queues_.size();
+}
+
+inline WorkStealingPool& WorkStealingPool::shared()
+{
+    static WorkStealingPool pool;
+    return pool;
+}
+
+inline void WorkStealingPool::parallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+    if(count == 0){
+        return;
+    }
+    std::lock_guard<std::mutex> run(runLock_);
+
+    // Deal out contiguous blocks so neighbouring tasks (often neighbouring
+    // keys) stay on the same worker unless they get stolen
+    size_t workers = queues_.size();
+    for(size_t w = 0; w < workers; ++w){
+        std::lock_guard<std::mutex> guard(queues_[w].lock);
+        size_t first = count * w / workers;
+        size_t last = count * (w + 1) / workers;
+        for(size_t i = first; i < last; ++i){
+            queues_[w].tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(jobLock_);
+        task_ = &task;
+        remaining_ = count;
+        busyWorkers_ = threads_.size();
+        ++generation_;
+    }
+    jobStart_.notify_all();
+
+    runTasks(0);
+
+    // Wait for the last task to finish and for every worker to leave the
+    // job, so task_ can't be touched after we return
+    std::unique_lock<std::mutex> guard(jobLock_);
+    while(remaining_ != 0 || busyWorkers_ != 0){
+        jobDone_.wait(guard);
+    }
+    task_ = nullptr;
+}
+
+inline void WorkStealingPool::workerLoop(size_t worker)
+{
+    size_t seen = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> guard(jobLock_);
+            while(!stopping_ && generation_ == seen){
+                jobStart_.wait(guard);
+            }
+            if(stopping_){
+                return;
+            }
+            seen = generation_;
+        }
+
+        runTasks(worker);
+
+        std::lock_guard<std::mutex> guard(jobLock_);
+        if(--busyWorkers_ == 0){
+            jobDone_.notify_all();
+        }
+    }
+}
+
+inline void WorkStealingPool::runTasks(size_t worker)
+{
+    size_t task;
+    while(popTask(worker, task) || stealTask(worker, task)){
+        (*task_)(task);
+        std::lock_guard<std::mutex> guard(jobLock_);
+        if(--remaining_ == 0){
+            jobDone_.notify_all();
+        }
+    }
+}
+
+inline bool WorkStealingPool::popTask(size_t worker, size_t& task)
+{
+    std::lock_guard<std::mutex> guard(queues_[worker].lock);
+    if(queues_[worker].tasks.empty()){
+        return false;
+    }
+    task = queues_[worker].tasks.front();
+    queues_[worker].tasks.pop_front();
+    return true;
+}
+
+/**
+* Takes the last task of the first other worker that still has some.
+* Victims are tried starting from the next worker so thieves spread out.
+*/
+inline bool WorkStealingPool::stealTask(size_t worker, size_t& task)
+{
+    size_t workers = queues_.size();
+    for(size_t i = 1; i < workers; ++i){
+        WorkQueue& victim = queues_[(worker + i) % workers];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(!victim.tasks.empty()){
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
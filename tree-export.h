@@ -0,0 +1,304 @@
+#ifndef TREE_EXPORT_H
+#define TREE_EXPORT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
+#include "tree-shape.h"
+
+/**
+* Streaming exporters that write a tree as Graphviz DOT or as nested
+* JSON straight to an ostream. Unlike printRoot() they have no size
+* limit: the walk keeps one stack frame per level, so memory is
+* O(height) no matter how many nodes get written.
+*/
+
+/**
+* What to write. Children that fall outside the depth limit or lose the
+* sampling draw are replaced by a stub (a "..." node in DOT,
+* {"elided": true} in JSON), so the output shows where the tree goes on.
+*/
+struct ExportOptions
+{
+    ExportOptions() : maxDepth(-1), sample(1.0), seed(1), values(true) { }
+
+    // Deepest level written, 0 being the top node; -1 means no limit
+    int maxDepth;
+    // Chance that each subtree below the top node is written at all
+    double sample;
+    // Seed for the sampling draws; the same seed keeps the same nodes
+    uint64_t seed;
+    // Whether the values are written next to the keys
+    bool values;
+};
+
+/**
+* One annotation of a node: ("key", "12"), ("value", "x"),
+* ("balance", "-1"), ... bare says JSON gets the text as it is (a
+* number or true/false) rather than as a string; whoever formats the
+* field sets it from the type, not from the text.
+*/
+struct ExportField
+{
+    ExportField(const std::string& name, const std::string& text, bool bare) :
+        name(name), text(text), bare(bare) { }
+
+    std::string name;
+    std::string text;
+    bool bare;
+};
+
+// One node's fields, the key first
+typedef std::vector<ExportField> ExportFields;
+
+// Integer types that operator<< prints as characters
+template <typename T>
+struct ExportIsChar
+{
+    static const bool value = std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+        std::is_same<T, unsigned char>::value || std::is_same<T, wchar_t>::value ||
+        std::is_same<T, char16_t>::value || std::is_same<T, char32_t>::value;
+};
+
+/**
+* Whether operator<< prints a T as a JSON number: integers and finite
+* floating point values do; characters (including int8_t and uint8_t),
+* infinities, NaN and every non-arithmetic type, std::string included,
+* go out as strings.
+*/
+template <typename T>
+typename std::enable_if<!std::is_arithmetic<T>::value, bool>::type exportJsonBare(const T&)
+{
+    return false;
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, bool>::type exportJsonBare(const T&)
+{
+    return !ExportIsChar<T>::value;
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, bool>::type exportJsonBare(const T& value)
+{
+    return std::isfinite(value);
+}
+
+/**
+* Collects whatever is streamed into it in text, so keys and values can
+* be formatted with operator<< without a stringstream per node.
+*/
+struct ExportText : public std::streambuf
+{
+    std::string text;
+
+protected:
+    int overflow(int c)
+    {
+        if(c != traits_type::eof()){
+            text.push_back((char)c);
+        }
+        return c;
+    }
+    std::streamsize xsputn(const char* data, std::streamsize count)
+    {
+        text.append(data, count);
+        return count;
+    }
+};
+
+/**
+* Sampling: every node gets a path code from its parent's (splitmix64 of
+* the parent's code and the side), and a child is kept when its code
+* mixed with the seed falls below sample. Both formats make the same
+* draws, whatever order they walk in.
+*/
+inline uint64_t exportMix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline bool exportKeep(uint64_t childPath, const ExportOptions& options)
+{
+    if(options.sample >= 1.0){
+        return true;
+    }
+    return (exportMix(childPath ^ options.seed) >> 11) * (1.0 / 9007199254740992.0) < options.sample;
+}
+
+inline void exportEscape(std::ostream& os, const std::string& text)
+{
+    for(size_t i = 0; i < text.size(); ++i){
+        unsigned char c = text[i];
+        if(c == '"' || c == '\\'){
+            os << '\\' << c;
+        }
+        else if(c == '\n'){
+            os << "\\n";
+        }
+        else if(c < 0x20){
+            const char* hex = "0123456789abcdef";
+            os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        }
+        else{
+            os << c;
+        }
+    }
+}
+
+inline void exportJsonScalar(std::ostream& os, const ExportField& field)
+{
+    if(field.bare){
+        os << field.text;
+    }
+    else{
+        os << '"';
+        exportEscape(os, field.text);
+        os << '"';
+    }
+}
+
+/**
+* Writes the subtree under root as a DOT digraph. describe(node, fields)
+* fills in a node's key and annotations; the label shows the key alone
+* and name=text for the rest.
+*/
+template <typename NodeT, typename Describe>
+void writeTreeDot(std::ostream& os, const NodeT* root, const ExportOptions& options, Describe describe)
+{
+    struct Frame {
+        const NodeT* node;
+        int depth;
+        // Id of the parent's DOT node, -1 for the top node
+        long parentId;
+        bool isLeft;
+        uint64_t path;
+    };
+    std::vector<Frame> stack;
+    ExportFields fields;
+    long nextId = 0;
+
+    os << "digraph BST {\n";
+    os << "  node [shape=box, fontname=\"monospace\"];\n";
+    if(root != nullptr){
+        Frame top = { root, 0, -1, false, 0 };
+        stack.push_back(top);
+    }
+    while(!stack.empty()){
+        Frame frame = stack.back();
+        stack.pop_back();
+        long id = nextId++;
+
+        fields.clear();
+        describe(frame.node, fields);
+        os << "  n" << id << " [label=\"";
+        for(size_t i = 0; i < fields.size(); ++i){
+            if(i > 0){
+                os << "\\n";
+                exportEscape(os, fields[i].name);
+                os << '=';
+            }
+            exportEscape(os, fields[i].text);
+        }
+        os << "\"];\n";
+        if(frame.parentId >= 0){
+            os << "  n" << frame.parentId << (frame.isLeft ? ":sw" : ":se") << " -> n" << id << ";\n";
+        }
+
+        // Right goes on first so the left subtree is written first
+        const NodeT* children[2] = { shapeRight(frame.node, 0), shapeLeft(frame.node, 0) };
+        for(int side = 0; side < 2; ++side){
+            if(children[side] == nullptr){
+                continue;
+            }
+            bool isLeft = side == 1;
+            uint64_t path = exportMix(frame.path * 2 + side);
+            if(frame.depth == options.maxDepth || !exportKeep(path, options)){
+                long stub = nextId++;
+                os << "  n" << stub << " [label=\"...\", shape=plaintext];\n";
+                os << "  n" << id << (isLeft ? ":sw" : ":se") << " -> n" << stub << " [style=dashed];\n";
+                continue;
+            }
+            Frame child = { children[side], frame.depth + 1, id, isLeft, path };
+            stack.push_back(child);
+        }
+    }
+    os << "}\n";
+}
+
+/**
+* Writes the subtree under root as one JSON object per node:
+* {"key": ..., <annotations>, "left": ..., "right": ...}, with null for a
+* missing child. An empty tree is null.
+*/
+template <typename NodeT, typename Describe>
+void writeTreeJson(std::ostream& os, const NodeT* root, const ExportOptions& options, Describe describe)
+{
+    struct Frame {
+        const NodeT* node;
+        int depth;
+        // 0: fields not written yet, 1: left child next, 2: right child
+        // next, 3: only the closing brace left
+        int phase;
+        uint64_t path;
+    };
+    std::vector<Frame> stack;
+    ExportFields fields;
+
+    if(root == nullptr){
+        os << "null\n";
+        return;
+    }
+    Frame top = { root, 0, 0, 0 };
+    stack.push_back(top);
+    while(!stack.empty()){
+        Frame& frame = stack.back();
+        if(frame.phase == 0){
+            fields.clear();
+            describe(frame.node, fields);
+            os << '{';
+            for(size_t i = 0; i < fields.size(); ++i){
+                os << (i > 0 ? ", \"" : "\"");
+                exportEscape(os, fields[i].name);
+                os << "\": ";
+                exportJsonScalar(os, fields[i]);
+            }
+            frame.phase = 1;
+            continue;
+        }
+        if(frame.phase == 3){
+            os << '}';
+            stack.pop_back();
+            continue;
+        }
+
+        bool isLeft = frame.phase == 1;
+        const NodeT* child = isLeft ? shapeLeft(frame.node, 0) : shapeRight(frame.node, 0);
+        int depth = frame.depth;
+        // Same side numbering as writeTreeDot(): 0 right, 1 left
+        uint64_t path = exportMix(frame.path * 2 + (isLeft ? 1 : 0));
+        ++frame.phase;
+        os << (isLeft ? ", \"left\": " : ", \"right\": ");
+        if(child == nullptr){
+            os << "null";
+        }
+        else if(depth == options.maxDepth || !exportKeep(path, options)){
+            os << "{\"elided\": true}";
+        }
+        else{
+            // frame may dangle after this push
+            Frame next = { child, depth + 1, 0, path };
+            stack.push_back(next);
+        }
+    }
+    os << '\n';
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef TREE_SHAPE_H
+#define TREE_SHAPE_H
+
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include "threadpool.h"
+
+/**
+* Shape checks and statistics that work on any binary tree node type,
+* both the plain Node struct from equal-paths.h (left/right members)
+* and the Node template from bst.h (getLeft()/getRight()). Everything
+* walks with an explicit stack, so degenerate trees are fine.
+*/
+
+// Child access: getLeft()/getRight() when the node has them, otherwise
+// the left/right members
+template <typename NodeT>
+auto shapeLeft(const NodeT* node, int) -> decltype(node->getLeft()) { return node->getLeft(); }
+template <typename NodeT>
+auto shapeLeft(const NodeT* node, long) -> decltype(node->left) { return node->left; }
+template <typename NodeT>
+auto shapeRight(const NodeT* node, int) -> decltype(node->getRight()) { return node->getRight(); }
+template <typename NodeT>
+auto shapeRight(const NodeT* node, long) -> decltype(node->right) { return node->right; }
+
+/**
+* What one pass over a tree finds out about its shape. Depths count
+* edges from the root, so a lone root is a leaf at depth 0.
+*/
+struct TreeShape
+{
+    TreeShape() : nodes(0), leaves(0), minLeafDepth(-1), maxLeafDepth(-1) { }
+
+    size_t nodes;
+    size_t leaves;
+    // -1 for an empty tree
+    int minLeafDepth;
+    int maxLeafDepth;
+    // leafDepths[d] is the number of leaves at depth d
+    std::vector<size_t> leafDepths;
+
+    // Same answer as equalPaths(): every leaf at the same depth
+    bool equalPaths() const { return minLeafDepth == maxLeafDepth; }
+
+    void addLeaf(int depth)
+    {
+        ++leaves;
+        if(leafDepths.size() <= (size_t)depth){
+            leafDepths.resize(depth + 1, 0);
+        }
+        ++leafDepths[depth];
+        minLeafDepth = (minLeafDepth == -1) ? depth : std::min(minLeafDepth, depth);
+        maxLeafDepth = std::max(maxLeafDepth, depth);
+    }
+
+    void merge(const TreeShape& other)
+    {
+        nodes += other.nodes;
+        leaves += other.leaves;
+        if(leafDepths.size() < other.leafDepths.size()){
+            leafDepths.resize(other.leafDepths.size(), 0);
+        }
+        for(size_t depth = 0; depth < other.leafDepths.size(); ++depth){
+            leafDepths[depth] += other.leafDepths[depth];
+        }
+        if(other.minLeafDepth != -1){
+            minLeafDepth = (minLeafDepth == -1) ? other.minLeafDepth : std::min(minLeafDepth, other.minLeafDepth);
+            maxLeafDepth = std::max(maxLeafDepth, other.maxLeafDepth);
+        }
+    }
+};
+
+/**
+* Walks the subtree under root (which sits at depth) and calls
+* visit(node, depth, isLeaf) for every node, in pre-order. visit returns
+* false to stop the walk early.
+*/
+template <typename NodeT, typename Visit>
+void walkShape(const NodeT* root, int depth, Visit& visit)
+{
+    std::vector<std::pair<const NodeT*, int> > stack;
+    if(root != nullptr){
+        stack.push_back(std::make_pair(root, depth));
+    }
+    while(!stack.empty()){
+        const NodeT* node = stack.back().first;
+        int nodeDepth = stack.back().second;
+        stack.pop_back();
+
+        const NodeT* left = shapeLeft(node, 0);
+        const NodeT* right = shapeRight(node, 0);
+        if(!visit(node, nodeDepth, left == nullptr && right == nullptr)){
+            return;
+        }
+        // Right goes on first so the left subtree comes first
+        if(right != nullptr){
+            stack.push_back(std::make_pair(right, nodeDepth + 1));
+        }
+        if(left != nullptr){
+            stack.push_back(std::make_pair(left, nodeDepth + 1));
+        }
+    }
+}
+
+/**
+* Splits a tree for the parallel versions: the subtrees that start
+* cutDepth levels down (about 8 per worker) go to pieces, and visit
+* sees every node above them. Returns false if visit stopped early.
+*/
+template <typename NodeT, typename Visit>
+bool splitShape(const NodeT* root, WorkStealingPool& pool, std::vector<std::pair<const NodeT*, int> >& pieces, Visit& visit)
+{
+    int cutDepth = 0;
+    for(size_t n = 1; n < pool.size() * 8; n *= 2){
+        ++cutDepth;
+    }
+
+    std::vector<std::pair<const NodeT*, int> > stack;
+    if(root != nullptr){
+        stack.push_back(std::make_pair(root, 0));
+    }
+    while(!stack.empty()){
+        const NodeT* node = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+        if(depth == cutDepth){
+            pieces.push_back(std::make_pair(node, depth));
+            continue;
+        }
+
+        const NodeT* left = shapeLeft(node, 0);
+        const NodeT* right = shapeRight(node, 0);
+        if(!visit(node, depth, left == nullptr && right == nullptr)){
+            return false;
+        }
+        if(right != nullptr){
+            stack.push_back(std::make_pair(right, depth + 1));
+        }
+        if(left != nullptr){
+            stack.push_back(std::make_pair(left, depth + 1));
+        }
+    }
+    return true;
+}
+
+/**
+* Node count and leaf depth histogram in one pass.
+*/
+template <typename NodeT>
+TreeShape treeShape(const NodeT* root)
+{
+    TreeShape shape;
+    auto visit = [&](const NodeT* node, int depth, bool isLeaf) -> bool {
+        ++shape.nodes;
+        if(isLeaf){
+            shape.addLeaf(depth);
+        }
+        return true;
+    };
+    walkShape(root, 0, visit);
+    return shape;
+}
+
+/**
+* The same, with the subtrees below the top few levels measured in
+* parallel and merged afterwards.
+*/
+template <typename NodeT>
+TreeShape treeShape(const NodeT* root, WorkStealingPool& pool)
+{
+    TreeShape shape;
+    auto visit = [&](const NodeT* node, int depth, bool isLeaf) -> bool {
+        ++shape.nodes;
+        if(isLeaf){
+            shape.addLeaf(depth);
+        }
+        return true;
+    };
+    std::vector<std::pair<const NodeT*, int> > pieces;
+    splitShape(root, pool, pieces, visit);
+
+    std::vector<TreeShape> parts(pieces.size());
+    pool.parallelFor(pieces.size(), [&](size_t i){
+        TreeShape& part = parts[i];
+        auto count = [&](const NodeT* node, int depth, bool isLeaf) -> bool {
+            ++part.nodes;
+            if(isLeaf){
+                part.addLeaf(depth);
+            }
+            return true;
+        };
+        walkShape(pieces[i].first, pieces[i].second, count);
+    });
+    for(size_t i = 0; i < parts.size(); ++i){
+        shape.merge(parts[i]);
+    }
+    return shape;
+}
+
+/**
+* equalPaths() with the subtrees checked in parallel. The first leaf
+* anyone reaches sets the depth every other leaf has to match; the
+* first mismatch stops all workers.
+*/
+template <typename NodeT>
+bool equalPathsParallel(const NodeT* root, WorkStealingPool& pool = WorkStealingPool::shared())
+{
+    std::atomic<int> leafDepth(-1);
+    std::atomic<bool> mismatch(false);
+    auto check = [&](const NodeT* node, int depth, bool isLeaf) -> bool {
+        if(mismatch.load(std::memory_order_relaxed)){
+            return false;
+        }
+        if(isLeaf){
+            int expected = -1;
+            if(!leafDepth.compare_exchange_strong(expected, depth) && expected != depth){
+                mismatch.store(true, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<std::pair<const NodeT*, int> > pieces;
+    if(!splitShape(root, pool, pieces, check)){
+        return false;
+    }
+    pool.parallelFor(pieces.size(), [&](size_t i){
+        walkShape(pieces[i].first, pieces[i].second, check);
+    });
+    return !mismatch.load();
+}
+
+#endif